@@ -0,0 +1,71 @@
+/******************************************************************
+This file is part of https://github.com/martinruenz/dataset-tools
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>
+*****************************************************************/
+
+/**
+ * Drop-in replacement for external/TUM-RGBD/associate.py, which scales to long sequences.
+ */
+
+#include "../common/common.h"
+#include "../common/common_association.h"
+#include <fstream>
+
+using namespace std;
+
+int main(int argc, char * argv[])
+{
+    Parser parser(argc, argv);
+
+    if(!parser.hasOption("--first") || !parser.hasOption("--second")){
+        cout << "Error, invalid arguments.\n"
+                "Mandatory --first: First text file (format: timestamp data), e.g. rgb.txt.\n"
+                "Mandatory --second: Second text file (format: timestamp data), e.g. depth.txt.\n"
+                "Optional --out: Output file (default: print to stdout).\n"
+                "Optional --offset: Time offset added to the timestamps of the second file (default: 0.0).\n"
+                "Optional --max_difference: Maximally allowed time difference for matching entries (default: 0.02).\n"
+                "Optional --first_only: Only output associated lines from first file.\n"
+                "\n"
+                "Unlike associate.py, timestamps are written as they appear in the input files.\n"
+                "Example: ./associate_timestamps --first rgb.txt --second depth.txt --out associations.txt" << endl;
+        return 1;
+    }
+
+    vector<TimestampedEntry> first = readTimestampList(parser.getOption("--first"));
+    vector<TimestampedEntry> second = readTimestampList(parser.getOption("--second"));
+    double offset = std::stod(parser.getStringOption("--offset", "0"));
+    double maxDifference = std::stod(parser.getStringOption("--max_difference", "0.02"));
+    bool firstOnly = parser.hasOption("--first_only");
+
+    vector<Association> associations = associateTimestamps(first, second, offset, maxDifference);
+
+    ofstream file;
+    if(parser.hasOption("--out")){
+        file.open(parser.getOption("--out"));
+        if(!file.is_open()) throw invalid_argument("Could not open output file: " + parser.getOption("--out"));
+    }
+    ostream& out = file.is_open() ? file : cout;
+    for(const Association& a : associations){
+        const TimestampedEntry& f = first[a.first];
+        const TimestampedEntry& s = second[a.second];
+        out << f.stamp << " " << f.data;
+        if(!firstOnly) out << " " << s.stamp << " " << s.data;
+        out << "\n";
+    }
+
+    if(file.is_open())
+        cout << "Associated " << associations.size() << " of " << first.size() << " / " << second.size() << " entries." << endl;
+    return 0;
+}
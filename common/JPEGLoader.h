@@ -0,0 +1,214 @@
+/*
+ * This file is part of ElasticFusion.
+ *
+ * Copyright (C) 2015 Imperial College London
+ *
+ * The use of the code within this file and all code within files that
+ * make up the software that is ElasticFusion is permitted for
+ * non-commercial purposes only.  The full terms and conditions that
+ * apply to the code within this file are detailed within the LICENSE.txt
+ * file and at <http://www.imperial.ac.uk/dyson-robotics-lab/downloads/elastic-fusion/elastic-fusion-license/>
+ * unless explicitly stated.  By downloading this file you agree to
+ * comply with these terms.
+ *
+ * If you wish to use any of this code for commercial purposes then
+ * please email researchcontracts.engineering@imperial.ac.uk.
+ *
+ */
+
+#ifndef TOOLS_JPEGLOADER_H_
+#define TOOLS_JPEGLOADER_H_
+
+#include <algorithm>
+#include <csetjmp>
+#include <stdio.h>
+#include <stdexcept>
+#include <string>
+
+extern "C"
+{
+#include "jpeglib.h"
+#include "jerror.h"
+}
+
+/**
+ * Persistent JPEG decoder. The libjpeg decompressor is created once and reused for every image, images are decoded
+ * straight into the caller's buffer, in the requested channel order (using libjpeg-turbo's extended colour spaces,
+ * if available). Optionally, images are decoded at 1/2, 1/4 or 1/8 of their resolution, which is done in the DCT domain
+ * and hence a lot cheaper than decoding at full resolution.
+ *
+ * A loader must not be shared between threads, use one loader per thread instead.
+ */
+class JPEGLoader
+{
+    public:
+        JPEGLoader()
+        {
+            cinfo.err = jpeg_std_error(&errorMgr.pub);
+            errorMgr.pub.error_exit = errorExit;
+            jpeg_create_decompress(&cinfo);
+
+            // Prepare for reading from memory
+            srcMgr.init_source = doNothing;
+            srcMgr.fill_input_buffer = fillInputBuffer;
+            srcMgr.skip_input_data = skipInputData;
+            srcMgr.resync_to_restart = jpeg_resync_to_restart;
+            srcMgr.term_source = doNothing;
+            cinfo.src = &srcMgr;
+        }
+
+        ~JPEGLoader()
+        {
+            jpeg_destroy_decompress(&cinfo);
+        }
+
+        JPEGLoader(const JPEGLoader&) = delete;
+        JPEGLoader& operator=(const JPEGLoader&) = delete;
+
+        /**
+         * @brief Read the size of the decoded image, without decoding it.
+         * @param scaleDenom 1, 2, 4 or 8; the image is decoded at 1/scaleDenom of its resolution
+         */
+        void readSize(const unsigned char * src, const int numBytes, int & width, int & height, int scaleDenom = 1)
+        {
+            if(setjmp(errorMgr.jump))
+            {
+                jpeg_abort_decompress(&cinfo);
+                throw std::runtime_error(std::string("JPEG decoding error: ") + errorMgr.message);
+            }
+
+            start(src, numBytes, false, scaleDenom);
+            width = cinfo.output_width;
+            height = cinfo.output_height;
+            jpeg_abort_decompress(&cinfo);
+        }
+
+        /**
+         * @brief Decode an image into 'data', which holds 'height' rows of 'width' pixels.
+         * @param width, height Size of the (scaled) image, as allocated by the caller. Images of any other size are
+         * rejected with std::runtime_error, as they would not fit into 'data'.
+         * @param swapChannels If false, the channels are stored in the order of the JPEG file (RGB), otherwise as BGR.
+         * @param step Size of an output row in bytes, 0 if rows are continuous.
+         * @param scaleDenom 1, 2, 4 or 8; the image is decoded at 1/scaleDenom of its resolution
+         */
+        void decode(const unsigned char * src, const int numBytes, unsigned char * data, int width, int height,
+                    bool swapChannels, size_t step = 0, int scaleDenom = 1)
+        {
+            if(setjmp(errorMgr.jump))
+            {
+                jpeg_abort_decompress(&cinfo);
+                throw std::runtime_error(std::string("JPEG decoding error: ") + errorMgr.message);
+            }
+
+            start(src, numBytes, swapChannels, scaleDenom);
+
+            jpeg_start_decompress(&cinfo);
+
+            if((int)cinfo.output_width != width || (int)cinfo.output_height != height)
+            {
+                const std::string size = std::to_string(cinfo.output_width) + "x" + std::to_string(cinfo.output_height);
+                jpeg_abort_decompress(&cinfo);
+                throw std::runtime_error("JPEG image has size " + size + ", expected " +
+                                         std::to_string(width) + "x" + std::to_string(height) + ".");
+            }
+            if(step == 0) step = width * 3;
+
+            JSAMPROW rows[MAX_ROWS];
+            while(cinfo.output_scanline < cinfo.output_height)
+            {
+                const int numRows = std::min<int>(int(MAX_ROWS), cinfo.output_height - cinfo.output_scanline);
+                for(int r = 0; r < numRows; r++)
+                    rows[r] = data + (cinfo.output_scanline + r) * step;
+                const int numRead = jpeg_read_scanlines(&cinfo, rows, numRows);
+
+#ifndef JCS_EXTENSIONS
+                if(swapChannels)
+                {
+                    for(int r = 0; r < numRead; r++)
+                    {
+                        unsigned char * pixel = rows[r];
+                        for(int i = 0; i < width; i++, pixel += 3) std::swap(pixel[0], pixel[2]);
+                    }
+                }
+#else
+                (void)numRead;
+#endif
+            }
+
+            jpeg_finish_decompress(&cinfo);
+        }
+
+        /// Decode a full resolution image with swapped channels, as stored by Logger2.
+        void readData(unsigned char * src, const int numBytes, unsigned char * data, int width, int height)
+        {
+            decode(src, numBytes, data, width, height, true);
+        }
+
+    private:
+        static const int MAX_ROWS = 16;
+
+        struct ErrorManager
+        {
+            jpeg_error_mgr pub;
+            jmp_buf jump;
+            char message[JMSG_LENGTH_MAX];
+        };
+
+        static void errorExit(j_common_ptr cinfo)
+        {
+            ErrorManager * err = (ErrorManager *)cinfo->err;
+            (*cinfo->err->format_message)(cinfo, err->message);
+            longjmp(err->jump, 1);
+        }
+
+        static void doNothing(j_decompress_ptr)
+        {
+
+        }
+
+        static boolean fillInputBuffer(j_decompress_ptr cinfo)
+        {
+            // Premature end of data, insert a fake EOI marker (like libjpeg's memory source)
+            static const JOCTET eoi[2] = { 0xFF, JPEG_EOI };
+            WARNMS(cinfo, JWRN_JPEG_EOF);
+            cinfo->src->next_input_byte = eoi;
+            cinfo->src->bytes_in_buffer = 2;
+            return TRUE;
+        }
+
+        static void skipInputData(j_decompress_ptr cinfo, long numBytes)
+        {
+            if(numBytes <= 0) return;
+            if((size_t)numBytes > cinfo->src->bytes_in_buffer) numBytes = cinfo->src->bytes_in_buffer;
+            cinfo->src->next_input_byte += numBytes;
+            cinfo->src->bytes_in_buffer -= numBytes;
+        }
+
+        void start(const unsigned char * src, const int numBytes, bool swapChannels, int scaleDenom)
+        {
+            if(scaleDenom != 1 && scaleDenom != 2 && scaleDenom != 4 && scaleDenom != 8)
+                throw std::invalid_argument("JPEG scale has to be 1, 2, 4 or 8.");
+
+            srcMgr.next_input_byte = src;
+            srcMgr.bytes_in_buffer = numBytes;
+
+            jpeg_read_header(&cinfo, TRUE);
+
+#ifdef JCS_EXTENSIONS
+            cinfo.out_color_space = swapChannels ? JCS_EXT_BGR : JCS_EXT_RGB;
+#else
+            cinfo.out_color_space = JCS_RGB;
+#endif
+            cinfo.scale_num = 1;
+            cinfo.scale_denom = scaleDenom;
+
+            jpeg_calc_output_dimensions(&cinfo);
+        }
+
+        jpeg_decompress_struct cinfo; // IJG JPEG codec structure
+        ErrorManager errorMgr;
+        jpeg_source_mgr srcMgr;
+};
+
+
+#endif /* TOOLS_JPEGLOADER_H_ */
@@ -0,0 +1,125 @@
+/******************************************************************
+This file is part of https://github.com/martinruenz/dataset-tools
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>
+*****************************************************************/
+
+/**
+ * Association of timestamped entries, as done by external/TUM-RGBD/associate.py, in O(n log n) instead of O(n^2).
+ */
+
+#pragma once
+
+#include "common_filesystem.h"
+#include "common_strings.h"
+
+#include <algorithm>
+#include <cmath>
+#include <string>
+#include <vector>
+
+/**
+ * @brief Line of a TUM-style list ("stamp d1 d2 d3 ...")
+ */
+struct TimestampedEntry {
+    double timestamp;
+    std::string stamp; // Timestamp as written in the file, to reproduce it without loss
+    std::string data;  // Remaining columns, separated by single spaces
+};
+
+struct Association {
+    size_t first;
+    size_t second;
+};
+
+/**
+ * @brief Read a TUM-style list. Comments (#) and lines without data are skipped, entries are sorted by timestamp.
+ * Like associate.py, commas and tabs are accepted as separators.
+ */
+inline std::vector<TimestampedEntry> readTimestampList(const std::string& path){
+    std::vector<TimestampedEntry> result;
+    for(std::string line : readFileLines(path, true)){
+        if(line[0] == '#') continue;
+        std::replace(line.begin(), line.end(), ',', ' ');
+        std::replace(line.begin(), line.end(), '\t', ' ');
+        std::vector<std::string> columns = splitString(line, ' ', false);
+        if(columns.size() < 2) continue;
+        TimestampedEntry entry;
+        entry.stamp = columns[0];
+        entry.timestamp = std::stod(columns[0]);
+        for(size_t c = 1; c < columns.size(); c++) entry.data += (c > 1 ? " " : "") + columns[c];
+        result.push_back(entry);
+    }
+    std::stable_sort(result.begin(), result.end(), [](const TimestampedEntry& a, const TimestampedEntry& b){
+        return a.timestamp < b.timestamp;
+    });
+    return result;
+}
+
+/**
+ * @brief Associate two sorted lists of timestamps, one-to-one.
+ *
+ * Yields the same result as associate.py: Among all pairs with |a - (b + offset)| < maxDifference, pairs are greedily
+ * accepted in order of increasing difference. Since both lists are sorted, candidate pairs are generated with a sliding
+ * window (two pointers), which is linear in the number of candidates, instead of testing all pairs.
+ *
+ * @param offset Time offset added to the second list (e.g. to model the delay between two sensors)
+ * @return Associations, sorted by the first timestamp
+ */
+inline std::vector<Association> associateTimestamps(const std::vector<double>& first, const std::vector<double>& second,
+                                                    double offset, double maxDifference){
+    struct Candidate {
+        double difference;
+        size_t first;
+        size_t second;
+    };
+    std::vector<Candidate> candidates;
+    candidates.reserve(std::min(first.size(), second.size()));
+
+    size_t windowBegin = 0;
+    for(size_t a = 0; a < first.size(); a++){
+        // The same expressions as for the differences are used, to not miss candidates due to rounding
+        while(windowBegin < second.size() && first[a] - (second[windowBegin] + offset) >= maxDifference) windowBegin++;
+        for(size_t b = windowBegin; b < second.size() && (second[b] + offset) - first[a] < maxDifference; b++){
+            const double difference = std::abs(first[a] - (second[b] + offset));
+            if(difference < maxDifference) candidates.push_back({ difference, a, b });
+        }
+    }
+
+    // Ties are broken by the timestamps, as in associate.py
+    std::sort(candidates.begin(), candidates.end(), [](const Candidate& x, const Candidate& y){
+        if(x.difference != y.difference) return x.difference < y.difference;
+        if(x.first != y.first) return x.first < y.first;
+        return x.second < y.second;
+    });
+
+    std::vector<bool> usedFirst(first.size(), false);
+    std::vector<bool> usedSecond(second.size(), false);
+    std::vector<Association> result;
+    for(const Candidate& c : candidates){
+        if(usedFirst[c.first] || usedSecond[c.second]) continue;
+        usedFirst[c.first] = usedSecond[c.second] = true;
+        result.push_back({ c.first, c.second });
+    }
+    std::sort(result.begin(), result.end(), [](const Association& x, const Association& y){ return x.first < y.first; });
+    return result;
+}
+
+inline std::vector<Association> associateTimestamps(const std::vector<TimestampedEntry>& first, const std::vector<TimestampedEntry>& second,
+                                                    double offset, double maxDifference){
+    std::vector<double> a(first.size()), b(second.size());
+    for(size_t i = 0; i < first.size(); i++) a[i] = first[i].timestamp;
+    for(size_t i = 0; i < second.size(); i++) b[i] = second[i].timestamp;
+    return associateTimestamps(a, b, offset, maxDifference);
+}
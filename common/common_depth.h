@@ -0,0 +1,89 @@
+/******************************************************************
+This file is part of https://github.com/martinruenz/dataset-tools
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>
+*****************************************************************/
+
+#pragma once
+
+#include "common_3d.h"
+#include "common_random.h"
+
+#include <iostream>
+#include <opencv2/core/core.hpp>
+
+// See: 'A Benchmark for RGB-D Visual Odometry, 3D Reconstruction and SLAM'
+//  or: 'Intrinsic Scene Properties from a Single RGB-D Image Supplementary Material'
+// The depth factor should scale depth values to meters (for instance 0.001 if depth is in mm)
+// Another approach can be found here: https://github.com/shurans/SUNCGtoolbox/blob/master/gaps/pkgs/R2Shapes/R2Grid.cpp ("AddNoise")
+// All random numbers are drawn from 'rng', so that concurrent callers can each use their own generator.
+inline cv::Mat addNoise(cv::Mat input, const PinholeParameters& intrinsics, bool withNormalShift, std::default_random_engine& rng,
+                        float depthFactor = 1, float discr = 35130.0) {
+
+    if(input.type() != CV_32FC1) {
+        std::cerr << "Error, wrong image format in addNoise()." << std::endl;
+        return cv::Mat();
+    }
+
+    const float sigma_s = 0.4f; //0.5f;
+    const float sigma_d = 1.0f / 5.0f; //1.0f / 6.0f;
+    std::normal_distribution<float> noiseD(0,sigma_d);
+    std::normal_distribution<float> noiseS(0,sigma_s);
+    std::uniform_real_distribution<float> coin(0,1);
+
+    cv::Mat depthCM;
+    input.convertTo(depthCM, CV_32FC1, 100 * depthFactor); // convert to cm
+
+    Projected3DCloud cloud;
+    if(withNormalShift) cloud.fromMat(depthCM, cv::Mat(), intrinsics);
+
+    auto Z = [&](int x, int y) -> float {
+        return depthCM.at<float>(clamp(y+(int)noiseS(rng),0,depthCM.rows-1),
+                                     clamp(x+(int)noiseS(rng),0,depthCM.cols-1));
+    };
+
+    cv::Mat result(depthCM.rows, depthCM.cols, CV_32FC1);
+    for (int i = 0; i < depthCM.rows; ++i){
+        float* pOut = result.ptr<float>(i);
+        for (int j = 0; j < depthCM.cols; ++j){
+
+            pOut[j] = discr / round(discr / Z(j,i) + noiseD(rng) + 0.5);
+
+            if(withNormalShift){
+                Point3D& point = cloud.at(j,i);
+                Eigen::Vector3d v = point.p.normalized();
+                float angle = acos(fabs(v.dot(point.n)));
+
+                std::normal_distribution<float> noiseN(0, 0.3 * angle/(pOut[j]+0.1));
+                float n = noiseN(rng);
+
+                if(angle < 0.46*M_PI) pOut[j] += n;
+                else if(coin(rng) <= (angle-M_PI_4) / M_PI_4) pOut[j] = 0;
+            }
+        }
+    }
+
+    result.convertTo(result, CV_32FC1, 0.01 * depthFactor);
+
+    // One way to visualise (or simply run CoFusion):
+    // Projected3DCloud plyCloudTest(result, Mat(), intrinsics, 0, 100);
+    // plyCloudTest.toPly("/path/test.ply");
+
+    return result;
+}
+
+inline cv::Mat addNoise(cv::Mat input, const PinholeParameters& intrinsics, bool withNormalShift, float depthFactor = 1, float discr = 35130.0) {
+    std::default_random_engine rng(std::chrono::system_clock::now().time_since_epoch().count());
+    return addNoise(input, intrinsics, withNormalShift, rng, depthFactor, discr);
+}
@@ -71,8 +71,9 @@ inline std::string getBasename(const std::string& filepath){
 
 
 inline std::string getDirectory(const std::string &filepath){
-    return boost::filesystem::path(filepath).parent_path().string() +
-           boost::filesystem::path::preferred_separator;
+    boost::filesystem::path parent = boost::filesystem::path(filepath).parent_path();
+    if(parent.empty()) return "";
+    return parent.string() + boost::filesystem::path::preferred_separator;
 }
 
 inline std::string getRelativePath(const std::string &root, const std::string &path){
@@ -119,6 +120,21 @@ inline std::vector<std::string> readFileLines(const std::string& path, bool remo
     return result;
 }
 
+inline std::vector<unsigned char> readFileBytes(const std::string& path){
+    std::ifstream file(path, std::ifstream::binary | std::ifstream::ate);
+    if(!file.is_open()) throw std::invalid_argument("Could not open file: " + path);
+    std::vector<unsigned char> result(file.tellg());
+    file.seekg(0);
+    if(!file.read((char*)result.data(), result.size())) throw std::runtime_error("Could not read file: " + path);
+    return result;
+}
+
+inline void writeFileBytes(const std::string& path, const void* data, size_t size){
+    std::ofstream file(path, std::ofstream::binary);
+    if(!file.is_open()) throw std::invalid_argument("Could not open file: " + path);
+    if(!file.write((const char*)data, size)) throw std::runtime_error("Could not write file: " + path);
+}
+
 inline std::vector<std::pair<std::string,std::string>> getFilePairs(const std::string& directory1, const std::string& directory2,
                                                              const std::string& prefix1, const std::string& prefix2,
                                                              const std::vector<std::string>& extensions1, const std::vector<std::string>& extensions2){
@@ -0,0 +1,673 @@
+/******************************************************************
+This file is part of https://github.com/martinruenz/dataset-tools
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>
+*****************************************************************/
+
+/**
+ * KLG-files start with a:
+ * int32_t: frame count
+ *
+ * Afterwards, for each frame:
+ * int64_t: timestamp (typically in microseconds)
+ * int32_t: depthSize
+ * int32_t: imageSize
+ * depthSize * unsigned char: depth_compress_buf (typically 16bit per pixel, typically in mm)
+ * imageSize * unsigned char: encodedImage->data.ptr
+ *
+ * See: https://github.com/mp3guy/Logger2/blob/master/src/Logger2.h
+ *
+ * The depth codec of a frame is detected from its payload: depthSize == width*height*2 means uncompressed depth,
+ * payloads starting with an RVL tag are RVL compressed (see common_rvl.h), everything else is zlib compressed.
+ *
+ * Version 2 files are valid version 1 files with additional data after the last frame, which is ignored by older
+ * readers. A v2 file ends with:
+ * Extra streams: per frame and stream, an opaque payload (e.g. "mask": PNG encoded ID image,
+ *                "pose": 7 doubles, tx ty tz qx qy qz qw, camera-to-world, as in TUM files)
+ * Metadata:      KlgMetadata, followed by numStreams * char[KLG_STREAM_NAME_SIZE] (zero-padded stream names)
+ * Index:         numFrames * KlgFooterEntry, followed by numFrames * numStreams * KlgStreamEntry (frame-major)
+ * Trailer:       KlgTrailer, the very last bytes of the file
+ *
+ * The per-frame CRC32 covers the depth and image payloads (not the frame header, such that timestamps can be edited).
+ */
+
+#pragma once
+
+#include "common_filesystem.h"
+#include "common_macros.h"
+#include "common_rvl.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <opencv2/core/core.hpp>
+#include <zlib.h>
+
+enum class KlgDepthCodec { Raw, Zlib, Rvl };
+
+inline KlgDepthCodec parseKlgDepthCodec(const std::string& name){
+    if(name == "raw") return KlgDepthCodec::Raw;
+    if(name == "zlib") return KlgDepthCodec::Zlib;
+    if(name == "rvl") return KlgDepthCodec::Rvl;
+    throw std::invalid_argument("Unknown depth codec: " + name);
+}
+
+const size_t KLG_FILE_HEADER_SIZE = sizeof(int32_t);
+const size_t KLG_FRAME_HEADER_SIZE = sizeof(int64_t) + 2 * sizeof(int32_t);
+
+struct KlgFrameInfo {
+    int64_t timestamp;
+    int32_t depthSize;
+    int32_t imageSize;
+    uint64_t offset; // Byte offset of the frame header within the file
+
+    uint64_t depthOffset() const { return offset + KLG_FRAME_HEADER_SIZE; }
+    uint64_t imageOffset() const { return depthOffset() + depthSize; }
+    uint64_t endOffset() const { return imageOffset() + imageSize; }
+};
+static_assert(sizeof(KlgFrameInfo) == 24, "KlgFrameInfo is stored as-is in index files.");
+
+const uint32_t KLG_VERSION = 2;
+const size_t KLG_STREAM_NAME_SIZE = 32;
+const uint32_t KLG_MAX_STREAMS = 256;
+
+inline const char* klgFooterMagic() { return "KLGFOOT2"; }
+
+struct KlgMetadata {
+    int32_t width = 0;
+    int32_t height = 0;
+    float fx = 0;
+    float fy = 0;
+    float cx = 0;
+    float cy = 0;
+    float depthScale = 0.001; // Metres per depth unit
+    int32_t reserved = 0;
+};
+static_assert(sizeof(KlgMetadata) == 32, "KlgMetadata is stored as-is in KLG files.");
+
+struct KlgFooterEntry {
+    KlgFrameInfo info;
+    uint32_t crc;
+    uint32_t reserved;
+};
+static_assert(sizeof(KlgFooterEntry) == 32, "KlgFooterEntry is stored as-is in KLG files.");
+
+struct KlgStreamEntry {
+    uint64_t offset;
+    uint32_t size;
+    uint32_t reserved;
+};
+static_assert(sizeof(KlgStreamEntry) == 16, "KlgStreamEntry is stored as-is in KLG files.");
+
+struct KlgTrailer {
+    uint64_t framesEnd;      // Offset of the first byte after the last frame
+    uint64_t metadataOffset;
+    uint64_t indexOffset;
+    uint32_t numFrames;
+    uint32_t numStreams;
+    uint32_t version;
+    uint32_t reserved;
+    char magic[8];
+};
+static_assert(sizeof(KlgTrailer) == 48, "KlgTrailer is stored as-is in KLG files.");
+
+/// Payload of an extra stream, see KlgWriter::writeFrame
+struct KlgStreamData {
+    const void* data;
+    uint32_t size;
+};
+
+/**
+ * @brief Read and validate the trailer of a v2 KLG file.
+ * @return False, if the file has no (consistent) v2 trailer.
+ */
+inline bool readKlgTrailer(int fd, uint64_t fileSize, KlgTrailer& trailer){
+    if(fileSize < KLG_FILE_HEADER_SIZE + sizeof(KlgTrailer)) return false;
+    if(pread(fd, &trailer, sizeof(KlgTrailer), fileSize - sizeof(KlgTrailer)) != sizeof(KlgTrailer)) return false;
+    if(memcmp(trailer.magic, klgFooterMagic(), sizeof(trailer.magic)) != 0 || trailer.version < 2) return false;
+    if(trailer.numStreams > KLG_MAX_STREAMS) return false;
+    const uint64_t indexSize = uint64_t(trailer.numFrames) * (sizeof(KlgFooterEntry) + trailer.numStreams * sizeof(KlgStreamEntry));
+    return trailer.framesEnd >= KLG_FILE_HEADER_SIZE &&
+            trailer.framesEnd <= trailer.metadataOffset &&
+            trailer.metadataOffset + sizeof(KlgMetadata) + trailer.numStreams * KLG_STREAM_NAME_SIZE == trailer.indexOffset &&
+            trailer.indexOffset + indexSize + sizeof(KlgTrailer) == fileSize;
+}
+
+/**
+ * @brief Result of a header-only pass over a KLG file.
+ */
+struct KlgScan {
+    int32_t headerFrameCount = 0;
+    uint64_t fileSize = 0;
+    std::vector<KlgFrameInfo> frames; // Complete frames only
+    bool truncated = false;           // True, if fewer frames than announced are readable
+    uint64_t truncationOffset = 0;    // Offset of the first incomplete frame (iff truncated)
+    bool hasFooter = false;           // True, if the file has a v2 footer (which is not scanned as frames)
+};
+
+/**
+ * @brief Walk the per-frame headers of a KLG file, using positioned reads only (payloads are skipped).
+ * Scanning stops at the announced frame count or at the first incomplete frame.
+ * @param fd File descriptor of an opened KLG file
+ * @param ignoreFrameCount Scan up to the end of the file, regardless of the announced frame count (which is 0 for
+ * recordings that were interrupted before the header was patched). In this case, 'truncated' is only set if the file
+ * ends with an incomplete frame.
+ * @return Frame offsets, sizes and timestamps
+ */
+inline KlgScan scanKlgHeaders(int fd, bool ignoreFrameCount = false){
+    KlgScan result;
+    struct stat st;
+    if(fstat(fd, &st) != 0) throw std::runtime_error("Could not stat KLG file.");
+    result.fileSize = st.st_size;
+    if(pread(fd, &result.headerFrameCount, sizeof(int32_t), 0) != sizeof(int32_t))
+        throw std::invalid_argument("KLG file is too small to contain a header.");
+    if(result.headerFrameCount < 0 && !ignoreFrameCount) throw std::invalid_argument("KLG file announces a negative number of frames.");
+
+    // Frames end where the v2 footer begins
+    KlgTrailer trailer;
+    result.hasFooter = readKlgTrailer(fd, result.fileSize, trailer);
+    const uint64_t framesEnd = result.hasFooter ? trailer.framesEnd : result.fileSize;
+
+    // Corrupt headers can announce absurd frame counts, never reserve more than the file can hold
+    result.frames.reserve(ignoreFrameCount ? 0 : std::min<uint64_t>(result.headerFrameCount, result.fileSize / KLG_FRAME_HEADER_SIZE));
+    uint64_t offset = KLG_FILE_HEADER_SIZE;
+    unsigned char header[KLG_FRAME_HEADER_SIZE];
+    for(int32_t i = 0; ignoreFrameCount ? offset < framesEnd : i < result.headerFrameCount; i++){
+        KlgFrameInfo info;
+        info.offset = offset;
+        if(offset + KLG_FRAME_HEADER_SIZE > framesEnd ||
+                pread(fd, header, KLG_FRAME_HEADER_SIZE, offset) != (ssize_t)KLG_FRAME_HEADER_SIZE){
+            result.truncated = true;
+            result.truncationOffset = offset;
+            break;
+        }
+        memcpy(&info.timestamp, header, sizeof(int64_t));
+        memcpy(&info.depthSize, header + sizeof(int64_t), sizeof(int32_t));
+        memcpy(&info.imageSize, header + sizeof(int64_t) + sizeof(int32_t), sizeof(int32_t));
+        if(info.depthSize < 0 || info.imageSize < 0 || info.endOffset() > framesEnd){
+            result.truncated = true;
+            result.truncationOffset = offset;
+            break;
+        }
+        result.frames.push_back(info);
+        offset = info.endOffset();
+    }
+    return result;
+}
+
+/**
+ * @brief Copy a byte range between two files without changing their file positions. The copy is done by the kernel
+ * (copy_file_range, which can share extents on copy-on-write filesystems), with a read/write fallback.
+ */
+inline void copyFileRange(int inFd, uint64_t inOffset, int outFd, uint64_t outOffset, uint64_t length){
+    loff_t in = inOffset, out = outOffset;
+    while(length > 0){
+        ssize_t n = copy_file_range(inFd, &in, outFd, &out, length, 0);
+        if(n <= 0) break; // Unsupported (e.g. across filesystems or on old kernels), fall back to user-space copies
+        length -= n;
+    }
+
+    std::vector<char> buffer(std::min<uint64_t>(length, 1 << 22));
+    while(length > 0){
+        ssize_t n = pread(inFd, buffer.data(), std::min<uint64_t>(length, buffer.size()), in);
+        if(n <= 0) throw std::runtime_error("Could not read from file.");
+        if(pwrite(outFd, buffer.data(), n, out) != n) throw std::runtime_error("Could not write to file.");
+        in += n;
+        out += n;
+        length -= n;
+    }
+}
+
+/**
+ * @brief Memory-mapped, indexed access to the frames of a KLG file.
+ *
+ * On construction, a frame-offset index is either loaded from a sidecar file (e.g. 'log.klg.idx') or built with a
+ * single header-only pass, after which it is persisted as such a sidecar. Any frame can then be accessed without
+ * touching the payloads of other frames. Uncompressed payloads are exposed as zero-copy, read-only cv::Mat views.
+ * Files with a v2 footer are indexed by their footer, which also provides metadata, CRCs and extra streams.
+ */
+class KlgReader {
+public:
+
+    KlgReader(const std::string& path, bool useIndexFile = true) : path(path) {
+        fd = open(path.c_str(), O_RDONLY);
+        if(fd < 0) throw std::invalid_argument("Could not open KLG file: " + path);
+
+        try {
+            if(!loadFooter() && (!useIndexFile || !loadIndex())){
+                KlgScan scan = scanKlgHeaders(fd);
+                headerFrameCount = scan.headerFrameCount;
+                fileSize = scan.fileSize;
+                truncated = scan.truncated;
+                frames.swap(scan.frames);
+                if(useIndexFile) saveIndex();
+            }
+        } catch(...) {
+            close(fd);
+            throw;
+        }
+
+        if(fileSize > 0){
+            mapping = (unsigned char*)mmap(nullptr, fileSize, PROT_READ, MAP_PRIVATE, fd, 0);
+            if(mapping == MAP_FAILED) {
+                close(fd);
+                throw std::runtime_error("Could not map KLG file: " + path);
+            }
+        }
+    }
+
+    ~KlgReader(){
+        if(mapping) munmap(mapping, fileSize);
+        close(fd);
+    }
+
+    KlgReader(const KlgReader&) = delete;
+    KlgReader& operator=(const KlgReader&) = delete;
+
+    static std::string indexPath(const std::string& klgPath){
+        return klgPath + ".idx";
+    }
+
+    /// Number of readable frames (can be smaller than the frame count stored in the file header, see isTruncated())
+    size_t numFrames() const { return frames.size(); }
+    int32_t getHeaderFrameCount() const { return headerFrameCount; }
+    bool isTruncated() const { return truncated; }
+    uint64_t getFileSize() const { return fileSize; }
+    const std::string& getPath() const { return path; }
+    int getFileDescriptor() const { return fd; }
+
+    /// True, if the file has a v2 footer. Otherwise, metadata is empty and there are neither CRCs nor extra streams.
+    bool hasFooter() const { return footer; }
+    const KlgMetadata& getMetadata() const { return metadata; }
+    size_t numStreams() const { return streamNames.size(); }
+    const std::string& streamName(size_t s) const { return streamNames.at(s); }
+
+    /// Index of the extra stream called 'name', or -1 if there is no such stream
+    int findStream(const std::string& name) const {
+        for(size_t s = 0; s < streamNames.size(); s++) if(streamNames[s] == name) return s;
+        return -1;
+    }
+
+    const KlgStreamEntry& streamEntry(size_t s, size_t i) const {
+        if(s >= numStreams()) throw std::out_of_range("KLG stream index out of range.");
+        frameInfo(i);
+        return streams[i * numStreams() + s];
+    }
+    const unsigned char* streamData(size_t s, size_t i) const { return mapping + streamEntry(s, i).offset; }
+    uint32_t streamSize(size_t s, size_t i) const { return streamEntry(s, i).size; }
+
+    /// Check the payloads of frame i against their CRC (always true, if the file has no CRCs)
+    bool verifyFrame(size_t i) const {
+        if(!footer) return true;
+        const KlgFrameInfo& info = frameInfo(i);
+        uLong crc = crc32(0L, depthData(i), info.depthSize);
+        crc = crc32(crc, imageData(i), info.imageSize);
+        return crc == crcs[i];
+    }
+
+    const KlgFrameInfo& frameInfo(size_t i) const {
+        if(i >= frames.size()) throw std::out_of_range("KLG frame index out of range.");
+        return frames[i];
+    }
+    const std::vector<KlgFrameInfo>& frameInfos() const { return frames; }
+
+    int64_t timestamp(size_t i) const { return frameInfo(i).timestamp; }
+    const unsigned char* depthData(size_t i) const { return mapping + frameInfo(i).depthOffset(); }
+    const unsigned char* imageData(size_t i) const { return mapping + frameInfo(i).imageOffset(); }
+
+    /// Ask the kernel to read the payloads of frame i ahead of their use (non-blocking)
+    void prefetch(size_t i) const {
+        const KlgFrameInfo& info = frameInfo(i);
+        const uint64_t pageSize = sysconf(_SC_PAGESIZE);
+        const uint64_t begin = info.offset / pageSize * pageSize;
+        madvise(mapping + begin, info.endOffset() - begin, MADV_WILLNEED);
+    }
+
+    bool isDepthRaw(size_t i, int width, int height) const {
+        return frameInfo(i).depthSize == width * height * 2;
+    }
+    bool isImageRaw(size_t i, int width, int height) const {
+        return frameInfo(i).imageSize == width * height * 3;
+    }
+
+    KlgDepthCodec depthCodec(size_t i, int width, int height) const {
+        if(isDepthRaw(i, width, height)) return KlgDepthCodec::Raw;
+        if(isRvlDepth(depthData(i), frameInfo(i).depthSize)) return KlgDepthCodec::Rvl;
+        return KlgDepthCodec::Zlib;
+    }
+
+    /// Zero-copy, read-only CV_16UC1 view of an uncompressed depth payload. Empty if the payload is compressed.
+    cv::Mat depthView(size_t i, int width, int height) const {
+        if(!isDepthRaw(i, width, height)) return cv::Mat();
+        return cv::Mat(height, width, CV_16UC1, (void*)depthData(i));
+    }
+
+    /// Zero-copy, read-only CV_8UC3 view of an uncompressed colour payload. Empty if the payload is compressed.
+    cv::Mat imageView(size_t i, int width, int height) const {
+        if(!isImageRaw(i, width, height)) return cv::Mat();
+        return cv::Mat(height, width, CV_8UC3, (void*)imageData(i));
+    }
+
+    /**
+     * @brief Provide the depth image of frame i. Uncompressed payloads are returned as views,
+     * compressed payloads are decoded into 'buffer', which is (re)allocated only if required.
+     */
+    cv::Mat readDepth(size_t i, int width, int height, cv::Mat& buffer) const {
+        cv::Mat view = depthView(i, width, height);
+        if(!view.empty()) return view;
+        buffer.create(height, width, CV_16UC1);
+        if(isRvlDepth(depthData(i), frameInfo(i).depthSize)){
+            decompressRvlDepth(depthData(i), frameInfo(i).depthSize, buffer.ptr<uint16_t>(), buffer.total());
+            return buffer;
+        }
+        uLongf decompLength = width * height * 2;
+        if(uncompress(buffer.data, &decompLength, depthData(i), frameInfo(i).depthSize) != Z_OK)
+            throw std::invalid_argument("Could not decompress depth of frame " + std::to_string(i) + ".");
+        return buffer;
+    }
+
+private:
+
+    struct IndexFileHeader {
+        char magic[8];
+        uint64_t fileSize;
+        int64_t modificationTime;
+        int32_t headerFrameCount;
+        int32_t truncated;
+        uint64_t numEntries;
+    };
+
+    bool loadFooter(){
+        struct stat st;
+        if(fstat(fd, &st) != 0) return false;
+        KlgTrailer trailer;
+        int32_t count;
+        if(!readKlgTrailer(fd, st.st_size, trailer)) return false;
+        if(pread(fd, &count, sizeof(int32_t), 0) != sizeof(int32_t) || count != (int32_t)trailer.numFrames) return false;
+
+        KlgMetadata meta;
+        const size_t numStreams = trailer.numStreams;
+        std::vector<char> names(numStreams * KLG_STREAM_NAME_SIZE);
+        std::vector<KlgFooterEntry> entries(trailer.numFrames);
+        std::vector<KlgStreamEntry> streamEntries(trailer.numFrames * numStreams);
+        const size_t entriesSize = entries.size() * sizeof(KlgFooterEntry);
+        const size_t streamEntriesSize = streamEntries.size() * sizeof(KlgStreamEntry);
+        if(pread(fd, &meta, sizeof(KlgMetadata), trailer.metadataOffset) != sizeof(KlgMetadata) ||
+                pread(fd, names.data(), names.size(), trailer.metadataOffset + sizeof(KlgMetadata)) != (ssize_t)names.size() ||
+                pread(fd, entries.data(), entriesSize, trailer.indexOffset) != (ssize_t)entriesSize ||
+                pread(fd, streamEntries.data(), streamEntriesSize, trailer.indexOffset + entriesSize) != (ssize_t)streamEntriesSize)
+            return false;
+        for(const KlgFooterEntry& e : entries)
+            if(e.info.depthSize < 0 || e.info.imageSize < 0 || e.info.endOffset() > trailer.framesEnd) return false;
+        for(const KlgStreamEntry& e : streamEntries)
+            if(e.offset < trailer.framesEnd || e.offset + e.size > trailer.metadataOffset) return false;
+
+        frames.resize(entries.size());
+        crcs.resize(entries.size());
+        for(size_t i = 0; i < entries.size(); i++){
+            frames[i] = entries[i].info;
+            crcs[i] = entries[i].crc;
+        }
+        for(size_t s = 0; s < numStreams; s++){
+            const char* name = names.data() + s * KLG_STREAM_NAME_SIZE;
+            streamNames.emplace_back(name, strnlen(name, KLG_STREAM_NAME_SIZE));
+        }
+        streams.swap(streamEntries);
+        metadata = meta;
+        headerFrameCount = count;
+        fileSize = st.st_size;
+        truncated = false;
+        footer = true;
+        return true;
+    }
+
+    bool loadIndex(){
+        struct stat st;
+        if(fstat(fd, &st) != 0) return false;
+        std::ifstream in(indexPath(path), std::ios::binary | std::ios::ate);
+        if(!in.is_open()) return false;
+        const uint64_t indexSize = in.tellg();
+        in.seekg(0);
+        IndexFileHeader h;
+        if(!in.read((char*)&h, sizeof(h))) return false;
+        if(memcmp(h.magic, indexMagic(), sizeof(h.magic)) != 0 ||
+                h.fileSize != (uint64_t)st.st_size ||
+                h.modificationTime != (int64_t)st.st_mtime) return false;
+        // The entry count is not trusted, a corrupt index would otherwise trigger a huge allocation
+        if(h.numEntries > (indexSize - sizeof(h)) / sizeof(KlgFrameInfo)) return false;
+        frames.resize(h.numEntries);
+        if(!in.read((char*)frames.data(), h.numEntries * sizeof(KlgFrameInfo))) {
+            frames.clear();
+            return false;
+        }
+        // Payloads are accessed in the mapping without further checks, a stale or corrupt index is rescanned
+        for(const KlgFrameInfo& f : frames){
+            if(f.depthSize < 0 || f.imageSize < 0 || f.offset > h.fileSize || f.endOffset() > h.fileSize){
+                frames.clear();
+                return false;
+            }
+        }
+        headerFrameCount = h.headerFrameCount;
+        truncated = h.truncated;
+        fileSize = h.fileSize;
+        return true;
+    }
+
+    void saveIndex() const {
+        struct stat st;
+        if(fstat(fd, &st) != 0) return;
+        IndexFileHeader h;
+        memcpy(h.magic, indexMagic(), sizeof(h.magic));
+        h.fileSize = fileSize;
+        h.modificationTime = st.st_mtime;
+        h.headerFrameCount = headerFrameCount;
+        h.truncated = truncated;
+        h.numEntries = frames.size();
+        // The index is a cache only, failing to write it (read-only media) is not an error.
+        std::ofstream out(indexPath(path), std::ios::binary);
+        if(!out.is_open()) return;
+        out.write((const char*)&h, sizeof(h));
+        out.write((const char*)frames.data(), frames.size() * sizeof(KlgFrameInfo));
+    }
+
+    static const char* indexMagic() { return "KLGIDX01"; }
+
+    std::string path;
+    int fd = -1;
+    unsigned char* mapping = nullptr;
+    uint64_t fileSize = 0;
+    int32_t headerFrameCount = 0;
+    bool truncated = false;
+    std::vector<KlgFrameInfo> frames;
+
+    // v2 footer
+    bool footer = false;
+    KlgMetadata metadata;
+    std::vector<uint32_t> crcs;
+    std::vector<std::string> streamNames;
+    std::vector<KlgStreamEntry> streams; // Frame-major
+};
+
+/**
+ * @brief Compress a CV_16UC1 depth image with zlib, as done by Logger2.
+ * @param out Compressed data, the vector is only reallocated if it is too small.
+ */
+inline void compressKlgDepth(const cv::Mat& depth, std::vector<unsigned char>& out, int level = Z_BEST_SPEED){
+    if(depth.type() != CV_16UC1 || !depth.isContinuous()) throw std::invalid_argument("Depth has to be continuous CV_16UC1 data.");
+    const uLong rawSize = depth.total() * depth.elemSize();
+    uLongf compressedSize = compressBound(rawSize);
+    out.resize(compressedSize);
+    if(compress2(out.data(), &compressedSize, depth.data, rawSize, level) != Z_OK)
+        throw std::runtime_error("Could not compress depth image.");
+    out.resize(compressedSize);
+}
+
+/**
+ * @brief Encode a CV_16UC1 depth image with the given codec. Raw depth is copied as-is.
+ */
+inline void compressKlgDepth(const cv::Mat& depth, std::vector<unsigned char>& out, KlgDepthCodec codec){
+    switch(codec){
+    case KlgDepthCodec::Zlib:
+        compressKlgDepth(depth, out);
+        break;
+    case KlgDepthCodec::Rvl:
+        compressRvlDepth(depth, out);
+        break;
+    case KlgDepthCodec::Raw:
+        if(depth.type() != CV_16UC1 || !depth.isContinuous()) throw std::invalid_argument("Depth has to be continuous CV_16UC1 data.");
+        out.assign(depth.data, depth.data + depth.total() * depth.elemSize());
+        break;
+    }
+}
+
+/**
+ * @brief Write KLG-files frame by frame. The frame count in the file header is patched when closing the file.
+ * After enableFooter(), a v2 footer (metadata, index, CRCs and extra streams) is appended when closing the file.
+ * Extra stream payloads are buffered in a temporary file next to the output.
+ */
+class KlgWriter {
+public:
+
+    KlgWriter(const std::string& path) : path(path) {
+        out.open(path, std::ofstream::binary);
+        if(!out.is_open()) throw std::invalid_argument("Could not open output file: " + path);
+        out.write((const char*)&frameCount, sizeof(frameCount));
+    }
+
+    ~KlgWriter(){
+        try {
+            close();
+        } catch(...) {}
+    }
+
+    KlgWriter(const KlgWriter&) = delete;
+    KlgWriter& operator=(const KlgWriter&) = delete;
+
+    /**
+     * @brief Write a v2 file. Has to be called before the first frame is written.
+     * @param streamNames Names of extra per-frame streams, each frame has to provide a payload for each stream.
+     */
+    void enableFooter(const KlgMetadata& metadata, const std::vector<std::string>& streamNames = {}){
+        if(frameCount > 0) throw std::runtime_error("The KLG footer has to be enabled before writing frames.");
+        if(streamNames.size() > KLG_MAX_STREAMS) throw std::invalid_argument("Too many KLG streams.");
+        for(const std::string& name : streamNames)
+            if(name.empty() || name.size() > KLG_STREAM_NAME_SIZE) throw std::invalid_argument("Invalid KLG stream name: " + name);
+        this->metadata = metadata;
+        this->streamNames = streamNames;
+        footer = true;
+        if(streamNames.size()){
+            streamOut.open(streamsPath(), std::ofstream::binary | std::ofstream::trunc);
+            if(!streamOut.is_open()) throw std::invalid_argument("Could not open temporary file: " + streamsPath());
+        }
+    }
+
+    void writeFrame(int64_t timestamp, const void* depth, int32_t depthSize, const void* image, int32_t imageSize,
+                    const std::vector<KlgStreamData>& streams = {}){
+        if(!out.is_open()) throw std::runtime_error("KLG file has already been closed: " + path);
+        if(streams.size() != streamNames.size()) throw std::invalid_argument("Number of KLG stream payloads does not match.");
+        out.write((const char*)&timestamp, sizeof(timestamp));
+        out.write((const char*)&depthSize, sizeof(depthSize));
+        out.write((const char*)&imageSize, sizeof(imageSize));
+        out.write((const char*)depth, depthSize);
+        out.write((const char*)image, imageSize);
+        if(!out) throw std::runtime_error("Could not write to KLG file: " + path);
+
+        if(footer){
+            KlgFooterEntry entry;
+            entry.info = { timestamp, depthSize, imageSize, offset };
+            entry.crc = crc32(crc32(0L, (const Bytef*)depth, depthSize), (const Bytef*)image, imageSize);
+            entry.reserved = 0;
+            entries.push_back(entry);
+            for(const KlgStreamData& d : streams){
+                streamEntries.push_back({ streamsSize, d.size, 0 });
+                streamOut.write((const char*)d.data, d.size);
+                streamsSize += d.size;
+            }
+            if(streams.size() && !streamOut) throw std::runtime_error("Could not write to temporary file: " + streamsPath());
+        }
+        offset += KLG_FRAME_HEADER_SIZE + depthSize + imageSize;
+        frameCount++;
+    }
+
+    void close(){
+        if(!out.is_open()) return;
+        if(footer) writeFooter();
+        out.seekp(0);
+        out.write((const char*)&frameCount, sizeof(frameCount));
+        out.close(); // Flushes, failures set the failbit as well
+        if(!out) throw std::runtime_error("Could not write to KLG file: " + path);
+    }
+
+    int32_t numFrames() const { return frameCount; }
+
+private:
+
+    std::string streamsPath() const { return path + ".streams.tmp"; }
+
+    void writeFooter(){
+        KlgTrailer trailer;
+        trailer.framesEnd = offset;
+        trailer.numFrames = frameCount;
+        trailer.numStreams = streamNames.size();
+        trailer.version = KLG_VERSION;
+        trailer.reserved = 0;
+        memcpy(trailer.magic, klgFooterMagic(), sizeof(trailer.magic));
+
+        if(streamOut.is_open()){
+            streamOut.close();
+            std::ifstream in(streamsPath(), std::ifstream::binary);
+            if(streamsSize > 0) out << in.rdbuf();
+            in.close();
+            std::remove(streamsPath().c_str());
+        }
+        trailer.metadataOffset = offset + streamsSize;
+        out.write((const char*)&metadata, sizeof(KlgMetadata));
+        for(const std::string& name : streamNames){
+            char buffer[KLG_STREAM_NAME_SIZE] = {};
+            memcpy(buffer, name.data(), name.size());
+            out.write(buffer, KLG_STREAM_NAME_SIZE);
+        }
+
+        trailer.indexOffset = trailer.metadataOffset + sizeof(KlgMetadata) + streamNames.size() * KLG_STREAM_NAME_SIZE;
+        out.write((const char*)entries.data(), entries.size() * sizeof(KlgFooterEntry));
+        for(KlgStreamEntry& e : streamEntries) e.offset += offset;
+        out.write((const char*)streamEntries.data(), streamEntries.size() * sizeof(KlgStreamEntry));
+        out.write((const char*)&trailer, sizeof(KlgTrailer));
+        if(!out) throw std::runtime_error("Could not write KLG footer: " + path);
+    }
+
+    std::string path;
+    std::ofstream out;
+    int32_t frameCount = 0;
+    uint64_t offset = KLG_FILE_HEADER_SIZE; // Offset of the next frame
+
+    // v2 footer
+    bool footer = false;
+    KlgMetadata metadata;
+    std::vector<std::string> streamNames;
+    std::vector<KlgFooterEntry> entries;
+    std::vector<KlgStreamEntry> streamEntries;
+    std::ofstream streamOut;
+    uint64_t streamsSize = 0;
+};
@@ -20,6 +20,16 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>
 #include "common.h"
 #include "connected_labels.h"
 
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
 // Example of distinct colours for labels
 extern const unsigned char L_COLORS[31][3] = { {0,0,0},
                                       {0,0,255},
@@ -63,57 +73,340 @@ cv::Vec3b intToColour(int label){
 }
 
 /**
- * @brief Uses intToColor pixel-wise, to convert an id-image to an RGB image, using the colour-table above
+ * @brief intToColour of all ids below 2^16, computed once. Entries are padded to 4 bytes, which allows for 4-byte
+ * stores (and loads) instead of 3-byte ones.
+ */
+inline const std::vector<cv::Vec4b>& labelColourTable(){
+    static const std::vector<cv::Vec4b> table = [](){
+        std::vector<cv::Vec4b> result(1 << 16);
+        for(size_t i = 0; i < result.size(); i++){
+            const cv::Vec3b c = intToColour(i);
+            result[i] = cv::Vec4b(c[0], c[1], c[2], 0);
+        }
+        return result;
+    }();
+    return table;
+}
+
+/// Look up the first channel of each pixel of 'input' in labelColourTable, ids outside of the table use intToColour
+template<typename T>
+void labelToColourRows(const cv::Mat& input, cv::Mat& result, bool parallel){
+    const cv::Vec4b* table = labelColourTable().data();
+    const uint32_t tableSize = labelColourTable().size();
+    const int channels = input.channels();
+    auto colour = [&](T label){
+        if(uint32_t(label) < tableSize) return table[uint32_t(label)];
+        const cv::Vec3b c = intToColour(label);
+        return cv::Vec4b(c[0], c[1], c[2], 0);
+    };
+    #pragma omp parallel for schedule(static) if(parallel)
+    for (int i = 0; i < input.rows; ++i){
+        const T* pIn = input.ptr<T>(i);
+        unsigned char* pOut = result.ptr<unsigned char>(i);
+        if(input.cols == 0) continue;
+        // The 4th byte is overwritten by the next pixel, except for the last pixel of a row
+        const int last = input.cols - 1;
+        for (int j = 0; j < last; ++j){
+            const cv::Vec4b c = colour(pIn[j * channels]);
+            memcpy(pOut + 3 * j, c.val, 4);
+        }
+        const cv::Vec4b c = colour(pIn[last * channels]);
+        memcpy(pOut + 3 * last, c.val, 3);
+    }
+}
+
+/**
+ * @brief Uses intToColor pixel-wise, to convert an id-image to an RGB image, using the colour-table above. Colours are
+ * looked up in a pre-computed table (labelColourTable), rows are processed in parallel (OpenMP).
  * @param input ID-image
+ * @param parallel Process rows in parallel. Disable this, if images are already processed by a pool of threads.
  * @return Colour image
  */
-cv::Mat labelToColourImage(cv::Mat input){
+cv::Mat labelToColourImage(cv::Mat input, bool parallel = true){
     cv::Mat result(input.rows, input.cols, CV_8UC3);
-    cv::Vec3b* pixel_ptr = (cv::Vec3b*)result.data;
-    if(input.type() == CV_8UC1) for(unsigned i = 0; i < result.total(); ++i) pixel_ptr[i] = intToColour(input.data[i]);
-    else if(input.type() == CV_32SC1) for(unsigned i = 0; i < result.total(); ++i) pixel_ptr[i] = intToColour(((int*)input.data)[i]);
-    else if(input.type() == CV_16UC1) for(unsigned i = 0; i < result.total(); ++i) pixel_ptr[i] = intToColour(((unsigned short*)input.data)[i]);
-    else if(input.type() == CV_8UC3) for(unsigned i = 0; i < result.total(); ++i) pixel_ptr[i] = intToColour((((cv::Vec3b*)input.data)[i])[0]);
+    if(input.type() == CV_8UC1 || input.type() == CV_8UC3) labelToColourRows<unsigned char>(input, result, parallel);
+    else if(input.type() == CV_32SC1) labelToColourRows<int>(input, result, parallel);
+    else if(input.type() == CV_16UC1) labelToColourRows<unsigned short>(input, result, parallel);
     else assert(0 && "labelToColourImage: Unknown input format.");
     return result;
 }
 
+/// Colours as 24-bit keys, used by the lookup structures of colourToLabelImage
+inline uint32_t packColour(const cv::Vec3b& colour){
+    return uint32_t(colour[0]) | (uint32_t(colour[1]) << 8) | (uint32_t(colour[2]) << 16);
+}
+
+inline cv::Vec3b unpackColour(uint32_t key){
+    return cv::Vec3b(key & 0xFF, (key >> 8) & 0xFF, (key >> 16) & 0xFF);
+}
+
+/**
+ * @brief Hash map from packed colours to ids (open addressing, linear probing). Unlike a direct 2^24 table, it stays
+ * small for the few colours of mask images, and concurrent lookups are safe as long as nothing is inserted.
+ */
+class ColourIndex {
+public:
+    ColourIndex(size_t expectedSize = 8){
+        size_t capacity = 16;
+        while(capacity < 2 * expectedSize) capacity *= 2;
+        rehash(capacity);
+    }
+
+    /// @return Pointer to the value of 'key', or nullptr
+    const int* find(uint32_t key) const {
+        for(size_t i = slot(key);; i = (i + 1) & mask){
+            if(keys[i] == key) return &values[i];
+            if(keys[i] == EMPTY) return nullptr;
+        }
+    }
+
+    /// Insert 'key', unless it already exists. @return Pointer to the stored value, and true if it was inserted
+    std::pair<int*, bool> insert(uint32_t key, int value){
+        if(2 * (count + 1) > keys.size()) rehash(2 * keys.size());
+        size_t i = slot(key);
+        for(; keys[i] != EMPTY; i = (i + 1) & mask)
+            if(keys[i] == key) return std::make_pair(&values[i], false);
+        keys[i] = key;
+        values[i] = value;
+        count++;
+        return std::make_pair(&values[i], true);
+    }
+
+    size_t size() const { return count; }
+
+private:
+    enum : uint32_t { EMPTY = 0xFFFFFFFF }; // Not a 24-bit key
+
+    size_t slot(uint32_t key) const { return (key * 2654435761u) & mask; }
+
+    void rehash(size_t capacity){
+        std::vector<uint32_t> oldKeys(capacity, EMPTY);
+        std::vector<int> oldValues(capacity);
+        keys.swap(oldKeys);
+        values.swap(oldValues);
+        mask = capacity - 1;
+        count = 0;
+        for(size_t i = 0; i < oldKeys.size(); i++) if(oldKeys[i] != EMPTY) insert(oldKeys[i], oldValues[i]);
+    }
+
+    std::vector<uint32_t> keys;
+    std::vector<int> values;
+    size_t mask = 0;
+    size_t count = 0;
+};
+
+/**
+ * @brief Uniform grid over RGB space, to find the lowest id of all colours within 'maxDiff' (euclidean) of a colour.
+ * Cells are at least 'maxDiff' wide, so that only the 27 cells around a colour have to be searched.
+ */
+class ColourGrid {
+public:
+    ColourGrid(float maxDiff) : maxDiff(maxDiff), cellSize(std::min(256, std::max(1, int(std::ceil(maxDiff))))) {}
+
+    /// Ids have to be added in ascending order
+    void add(const cv::Vec3b& colour, int id){
+        cells[cellKey(colour[0] / cellSize, colour[1] / cellSize, colour[2] / cellSize)].emplace_back(colour, id);
+    }
+
+    /// @return Lowest id within 'maxDiff', or -1
+    int find(const cv::Vec3b& colour) const {
+        const int numCells = 255 / cellSize + 1;
+        const int c0 = colour[0] / cellSize, c1 = colour[1] / cellSize, c2 = colour[2] / cellSize;
+        int best = -1;
+        for(int i0 = std::max(0, c0 - 1); i0 <= std::min(numCells - 1, c0 + 1); i0++)
+            for(int i1 = std::max(0, c1 - 1); i1 <= std::min(numCells - 1, c1 + 1); i1++)
+                for(int i2 = std::max(0, c2 - 1); i2 <= std::min(numCells - 1, c2 + 1); i2++){
+                    auto cell = cells.find(cellKey(i0, i1, i2));
+                    if(cell == cells.end()) continue;
+                    for(const Entry& e : cell->second){
+                        if(best >= 0 && e.second >= best) break;
+                        const int d0 = colour[0] - e.first[0], d1 = colour[1] - e.first[1], d2 = colour[2] - e.first[2];
+                        // Same comparison as cv::norm(colour, e.first) <= maxDiff
+                        if(std::sqrt(double(d0 * d0 + d1 * d1 + d2 * d2)) <= maxDiff){
+                            best = e.second;
+                            break;
+                        }
+                    }
+                }
+        return best;
+    }
+
+private:
+    typedef std::pair<cv::Vec3b, int> Entry;
+
+    static uint32_t cellKey(int i0, int i1, int i2){ return (uint32_t(i0) << 16) | (uint32_t(i1) << 8) | uint32_t(i2); }
+
+    float maxDiff;
+    int cellSize;
+    std::unordered_map<uint32_t, std::vector<Entry>> cells;
+};
+
 /**
  * @brief This function converts RGB-masks to id-masks
+ *
+ * Each pixel receives the lowest id of 'colorTable' within 'maxDiff', new colours are appended in the order in which
+ * they first appear (row-major). Rows are processed in parallel (OpenMP): First, pixels are looked up in the existing
+ * table, and the new colours of each row are collected. These are then added sequentially, row by row, which
+ * reproduces the order of a sequential scan. Colours within 'maxDiff' of a new colour would have matched it in a
+ * sequential scan as well, as ids only ever grow.
+ *
  * @param input Input image
  * @param colorTable Unique colours found in the input image. Can already be filled, in order to be consistent for all frames.
  * @param maxDiff Max difference between pixel-colour and colours in table, which still leads to an association.
+ * @param parallel Process rows in parallel. Disable this, if images are already processed by a pool of threads.
  * @return id-image
  */
-cv::Mat colourToLabelImage(cv::Mat input, std::vector<cv::Vec3b>& colorTable, float maxDiff = 0){
+cv::Mat colourToLabelImage(cv::Mat input, std::vector<cv::Vec3b>& colorTable, float maxDiff = 0, bool parallel = true){
     if(input.type() != CV_8UC3) { // This requirement could easily be avoided
         std::cout << "Error, wrong image format" << std::endl;
         return cv::Mat();
     }
     cv::Mat result(input.rows, input.cols, CV_8UC1);
-    for (int i = 0; i < input.rows; ++i){
-        //cv::Vec3b* pixel = input.ptr<cv::Vec3b>(i);
-        unsigned char* pOut = result.ptr<unsigned char>(i);
 
-        for (int j = 0; j < input.cols; ++j){
-            cv::Vec3b pixel = input.at<cv::Vec3b>(i, j);
-            int maskID = -1;
-            for(size_t id = 0; id < colorTable.size(); id++){
-                if(cv::norm(pixel,colorTable[id]) <= maxDiff) {
-                    maskID = id;
-                    break;
+    // Nothing is ever associated, each pixel gets a new id
+    if(!(maxDiff >= 0)){
+        for (int i = 0; i < input.rows; ++i){
+            const cv::Vec3b* pIn = input.ptr<cv::Vec3b>(i);
+            unsigned char* pOut = result.ptr<unsigned char>(i);
+            for (int j = 0; j < input.cols; ++j){
+                colorTable.push_back(pIn[j]);
+                pOut[j] = colorTable.size() - 1;
+            }
+        }
+        return result;
+    }
+
+    // Distances between distinct colours are at least 1, below that only equal colours match
+    const bool exact = maxDiff < 1;
+    ColourIndex index(colorTable.size());
+    ColourGrid grid(maxDiff);
+    for(size_t id = 0; id < colorTable.size(); id++){
+        if(exact) index.insert(packColour(colorTable[id]), id); // Keeps the first id of duplicates
+        else grid.add(colorTable[id], id);
+    }
+
+    // 1. Look up pixels in the existing table, -1 if not found
+    cv::Mat ids(input.rows, input.cols, CV_32SC1);
+    std::vector<std::vector<uint32_t>> newColours(input.rows); // Per row, in order of appearance
+    #pragma omp parallel if(parallel)
+    {
+        ColourIndex seen;  // Colour -> last row, in which it was found to be new
+        ColourIndex cache; // Colour -> id of 'grid' lookups
+        #pragma omp for schedule(static)
+        for(int i = 0; i < input.rows; ++i){
+            const cv::Vec3b* pIn = input.ptr<cv::Vec3b>(i);
+            int* pOut = ids.ptr<int>(i);
+            uint32_t lastKey = 0xFFFFFFFF;
+            int lastID = -1;
+            for(int j = 0; j < input.cols; ++j){
+                const uint32_t key = packColour(pIn[j]);
+                if(key != lastKey){
+                    lastKey = key;
+                    if(exact){
+                        const int* id = index.find(key);
+                        lastID = id ? *id : -1;
+                    } else {
+                        std::pair<int*, bool> cached = cache.insert(key, -1);
+                        if(cached.second) *cached.first = grid.find(pIn[j]);
+                        lastID = *cached.first;
+                    }
+                    if(lastID < 0){
+                        std::pair<int*, bool> s = seen.insert(key, i);
+                        if(s.second || *s.first != i){
+                            *s.first = i;
+                            newColours[i].push_back(key);
+                        }
+                    }
                 }
+                pOut[j] = lastID;
             }
-            if(maskID < 0) {
-                colorTable.push_back(pixel);
-                maskID = colorTable.size() - 1;
+        }
+    }
+
+    // 2. Add new colours sequentially, in row-major order of their first appearance
+    ColourIndex added;
+    for(const std::vector<uint32_t>& row : newColours){
+        for(uint32_t key : row){
+            if(added.find(key)) continue;
+            const cv::Vec3b colour = unpackColour(key);
+            int id = exact ? -1 : grid.find(colour); // Can only match colours added here
+            if(id < 0){
+                id = colorTable.size();
+                colorTable.push_back(colour);
+                if(!exact) grid.add(colour, id);
             }
-            pOut[j] = maskID;
+            added.insert(key, id);
         }
     }
+
+    // 3. Resolve new colours and write ids
+    #pragma omp parallel for schedule(static) if(parallel)
+    for(int i = 0; i < input.rows; ++i){
+        const cv::Vec3b* pIn = input.ptr<cv::Vec3b>(i);
+        const int* pID = ids.ptr<int>(i);
+        unsigned char* pOut = result.ptr<unsigned char>(i);
+        for(int j = 0; j < input.cols; ++j)
+            pOut[j] = pID[j] >= 0 ? pID[j] : *added.find(packColour(pIn[j]));
+    }
     return result;
 }
 
+/**
+ * @brief Unique colours of an image, in the order in which they first appear (row-major). Appending the new ones to a
+ * colour table assigns the same ids as colourToLabelImage (with maxDiff = 0) would.
+ * @param input Input image, has to be CV_8UC3.
+ */
+inline std::vector<cv::Vec3b> findColourOrder(const cv::Mat& input){
+    if(input.type() != CV_8UC3) throw std::invalid_argument("Error, invalid image format.");
+    std::vector<cv::Vec3b> result;
+    ColourIndex seen;
+    for (int i = 0; i < input.rows; ++i){
+        const cv::Vec3b* pIn = input.ptr<cv::Vec3b>(i);
+        uint32_t lastKey = 0xFFFFFFFF;
+        for (int j = 0; j < input.cols; ++j){
+            const uint32_t key = packColour(pIn[j]);
+            if(key == lastKey) continue;
+            lastKey = key;
+            if(seen.insert(key, result.size()).second) result.push_back(pIn[j]);
+        }
+    }
+    return result;
+}
+
+/**
+ * @brief Append the colours of 'colours', which are not in 'colorTable' yet, in order.
+ */
+inline void mergeColourTable(std::vector<cv::Vec3b>& colorTable, const std::vector<cv::Vec3b>& colours){
+    ColourIndex index(colorTable.size() + colours.size());
+    for(size_t id = 0; id < colorTable.size(); id++) index.insert(packColour(colorTable[id]), id);
+    for(const cv::Vec3b& c : colours)
+        if(index.insert(packColour(c), colorTable.size()).second) colorTable.push_back(c);
+}
+
+/**
+ * @brief Read a colour table as written by writeColourTable: One colour (r g b) per line, the n-th colour has id n.
+ * Lines starting with '#' are comments.
+ */
+inline std::vector<cv::Vec3b> readColourTable(const std::string& path){
+    std::vector<cv::Vec3b> result;
+    for(const std::string& line : readFileLines(path, true)){
+        if(line[0] == '#') continue;
+        int r, g, b;
+        std::istringstream iss(line);
+        if(!(iss >> r >> g >> b) || r < 0 || r > 255 || g < 0 || g > 255 || b < 0 || b > 255)
+            throw std::invalid_argument("Could not parse colour: " + line);
+        result.push_back(cv::Vec3b(b, g, r)); // OpenCV images are BGR
+    }
+    return result;
+}
+
+inline void writeColourTable(const std::string& path, const std::vector<cv::Vec3b>& colorTable){
+    std::ofstream file(path);
+    if(!file.is_open()) throw std::invalid_argument("Could not open output file: " + path);
+    file << "# r g b, the colour in line n (starting at 0, without comments) has id n\n";
+    for(const cv::Vec3b& c : colorTable) file << int(c[2]) << " " << int(c[1]) << " " << int(c[0]) << "\n";
+}
+
 /**
  * @brief Search for 'color' in 'colors' and return the index if found, -1 otherwise.
  * @param colors
@@ -0,0 +1,249 @@
+/******************************************************************
+This file is part of https://github.com/martinruenz/dataset-tools
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>
+*****************************************************************/
+
+/**
+ * Decode-ahead playback of frame sequences, as used by the viewers.
+ *
+ * FramePlayer keeps a ring of decoded frames, which is filled by worker threads with the frames that follow the
+ * current position in playback direction. Seeking, stepping and playing backwards or faster than real-time (with a
+ * stride) are served from the same ring. Slots are reused, hence decoding is free of per-frame allocations, as long
+ * as the decode function reuses the buffers of the frame it is given (e.g. with cv::Mat::create).
+ *
+ * PlaybackClock maps wall-clock time to frames, according to their recorded timestamps.
+ */
+
+#pragma once
+
+#include "common_threading.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <limits>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+template<typename Frame>
+class FramePlayer {
+public:
+    /// Decode frame 'index' into 'frame'. 'worker' (< number of threads) identifies the calling thread, for per-thread decoder state.
+    typedef std::function<void(size_t index, Frame& frame, size_t worker)> DecodeFunction;
+
+    /**
+     * @param numSlots Number of frames that are kept decoded
+     * @param numThreads Number of decoding threads, 0 for one less than the number of cores
+     */
+    FramePlayer(size_t numFrames, DecodeFunction decode, size_t numSlots = 16, size_t numThreads = 0)
+        : numFrames(numFrames), decode(decode), slots(std::max<size_t>(numSlots, 2)) {
+        if(numThreads == 0) numThreads = std::max(1u, defaultThreadCount() - 1);
+        for(size_t t = 0; t < numThreads; t++) workers.emplace_back([this, t](){ work(t); });
+    }
+
+    ~FramePlayer(){
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopped = true;
+        }
+        changed.notify_all();
+        for(std::thread& t : workers) t.join();
+    }
+
+    FramePlayer(const FramePlayer&) = delete;
+    FramePlayer& operator=(const FramePlayer&) = delete;
+
+    size_t size() const { return numFrames; }
+
+    /**
+     * @brief Provide frame 'index', blocks until it is decoded. The frame stays valid until the next call.
+     * The playback direction is derived from the previous call, frames are decoded ahead in this direction.
+     * @param stride Distance of frames that are decoded ahead, e.g. when frames are skipped during fast playback
+     */
+    const Frame& get(size_t index, size_t stride = 1){
+        if(index >= numFrames) throw std::out_of_range("Frame " + std::to_string(index) + " does not exist.");
+        std::unique_lock<std::mutex> lock(mutex);
+        if(index != position) direction = index > position ? 1 : -1;
+        position = index;
+        this->stride = std::max<size_t>(stride, 1);
+        changed.notify_all();
+
+        Slot* slot = nullptr;
+        ready.wait(lock, [&]{
+            slot = findSlot(index);
+            return errors.hasFailed() || (slot && slot->state == Ready);
+        });
+        if(errors.hasFailed()) errors.rethrow();
+        return slot->frame;
+    }
+
+private:
+    enum State { Empty, Decoding, Ready };
+
+    struct Slot {
+        Frame frame;
+        size_t index = std::numeric_limits<size_t>::max();
+        State state = Empty;
+    };
+
+    Slot* findSlot(size_t index){
+        for(Slot& s : slots) if(s.state != Empty && s.index == index) return &s;
+        return nullptr;
+    }
+
+    /// Is frame 'index' one of the frames that are supposed to be kept decoded?
+    bool isWanted(size_t index) const {
+        const int64_t distance = direction * (int64_t(index) - int64_t(position));
+        return distance >= 0 && distance % stride == 0 && size_t(distance / stride) < slots.size();
+    }
+
+    /// Find the most urgent frame that is not decoded yet, and a slot for it. Requires a locked mutex.
+    bool nextTask(size_t& index, Slot*& slot){
+        for(size_t k = 0; k < slots.size(); k++){
+            const int64_t i = int64_t(position) + direction * int64_t(k * stride);
+            if(i < 0 || i >= int64_t(numFrames)) return false;
+            if(findSlot(i)) continue;
+            for(Slot& s : slots){
+                if(s.state == Empty || (s.state == Ready && !isWanted(s.index))){
+                    index = i;
+                    slot = &s;
+                    return true;
+                }
+            }
+            return false;
+        }
+        return false;
+    }
+
+    void work(size_t worker){
+        std::unique_lock<std::mutex> lock(mutex);
+        while(true){
+            size_t index;
+            Slot* slot;
+            changed.wait(lock, [&]{ return stopped || errors.hasFailed() || nextTask(index, slot); });
+            if(stopped || errors.hasFailed()) return;
+
+            slot->index = index;
+            slot->state = Decoding;
+            lock.unlock();
+            const bool success = errors.capture([&](){ decode(index, slot->frame, worker); });
+            lock.lock();
+            slot->state = success ? Ready : Empty;
+            ready.notify_all();
+            changed.notify_all();
+        }
+    }
+
+    const size_t numFrames;
+    DecodeFunction decode;
+    std::vector<Slot> slots;
+    std::vector<std::thread> workers;
+    ThreadErrors errors;
+
+    std::mutex mutex;
+    std::condition_variable changed; // Position changed, or a slot became available
+    std::condition_variable ready;   // A frame was decoded
+    size_t position = 0;
+    size_t stride = 1;
+    int direction = 1;
+    bool stopped = false;
+};
+
+/**
+ * @brief Maps wall-clock time to frames, according to their timestamps. Supports pausing, seeking, stepping and
+ * playback at any speed (negative speeds play backwards).
+ */
+class PlaybackClock {
+public:
+    typedef std::chrono::steady_clock Clock;
+
+    /**
+     * @param timestamps Timestamps of all frames [us]. Decreasing timestamps are clamped, if all timestamps are equal
+     * (e.g. not recorded), frames are played at 'fps'.
+     */
+    PlaybackClock(std::vector<int64_t> timestamps, double fps = 30) : timestamps(timestamps) {
+        if(this->timestamps.empty()) throw std::invalid_argument("Can not play an empty sequence.");
+        for(size_t i = 1; i < this->timestamps.size(); i++) this->timestamps[i] = std::max(this->timestamps[i], this->timestamps[i-1]);
+        if(this->timestamps.front() == this->timestamps.back())
+            for(size_t i = 0; i < this->timestamps.size(); i++) this->timestamps[i] = int64_t(i * 1000000 / fps);
+        anchorTime = this->timestamps.front();
+    }
+
+    /// Frame that is due now
+    size_t frame() const {
+        const double t = mediaTime();
+        const auto it = std::upper_bound(timestamps.begin(), timestamps.end(), t, [](double t, int64_t ts){ return t < ts; });
+        return it == timestamps.begin() ? 0 : size_t(it - timestamps.begin()) - 1;
+    }
+
+    /// True, if playback reached the last (or, backwards, the first) frame
+    bool atEnd() const {
+        const double t = mediaTime();
+        return speed >= 0 ? t >= timestamps.back() : t <= timestamps.front();
+    }
+
+    bool isPlaying() const { return playing; }
+    void play(){ if(!playing){ anchor(); playing = true; } }
+    void pause(){ if(playing){ anchor(); playing = false; } }
+    void toggle(){ if(playing) pause(); else play(); }
+
+    double getSpeed() const { return speed; }
+    void setSpeed(double speed){
+        anchor();
+        this->speed = speed;
+    }
+
+    /// Continue playback at frame 'index' (also while playing)
+    void seek(size_t index){
+        anchorTime = timestamps[std::min(index, timestamps.size() - 1)];
+        anchorWallTime = Clock::now();
+    }
+
+    /// Pause and move by 'n' frames
+    void step(int n){
+        const size_t current = frame();
+        pause();
+        seek(size_t(std::max<int64_t>(0, int64_t(current) + n)));
+    }
+
+    /// Distance of frames that are shown at the current speed, if frames are displayed at 'displayRate' Hz
+    size_t stride(double displayRate = 30) const {
+        const double framesPerSecond = (timestamps.size() - 1) * 1000000.0 / std::max<int64_t>(1, timestamps.back() - timestamps.front());
+        return std::max<size_t>(1, size_t(std::abs(speed) * framesPerSecond / displayRate));
+    }
+
+private:
+    double mediaTime() const {
+        double t = anchorTime;
+        if(playing) t += speed * 1e6 * std::chrono::duration<double>(Clock::now() - anchorWallTime).count();
+        return std::min<double>(std::max<double>(t, timestamps.front()), timestamps.back());
+    }
+
+    void anchor(){
+        anchorTime = mediaTime();
+        anchorWallTime = Clock::now();
+    }
+
+    std::vector<int64_t> timestamps;
+    double anchorTime;
+    Clock::time_point anchorWallTime = Clock::now();
+    double speed = 1;
+    bool playing = false;
+};
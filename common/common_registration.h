@@ -0,0 +1,251 @@
+/******************************************************************
+This file is part of https://github.com/martinruenz/dataset-tools
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>
+*****************************************************************/
+
+/**
+ * Registration of depth and colour images of RGB-D cameras with different intrinsics and / or resolutions (e.g. scannet:
+ * 640x480 depth, 1296x968 colour).
+ *
+ * Per calibration, a warp table is computed once: For each depth pixel, the ray of the pixel is rotated into the
+ * colour camera and multiplied with its intrinsics. Warping a pixel with depth z then only requires
+ * (u*w, v*w, w) = z * table(x,y) + offset.
+ *
+ * Depth is forward-projected into the colour camera. Each depth pixel covers as many colour pixels as the ratio of the
+ * focal lengths suggests, which avoids holes when upsampling, and a z-buffer keeps the closest surface. Rows are
+ * processed in bands, in parallel (OpenMP), the z-buffer is updated with atomic compare-and-swap.
+ */
+
+#pragma once
+
+#include "common_3d.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+
+#include <opencv2/core/core.hpp>
+#include <opencv2/imgproc/imgproc.hpp>
+
+/// Intrinsics of a row-major 4x4 (or 3x3, padded to 4x4) camera matrix, as stored in scannet *.sens files
+inline PinholeParameters pinholeFromMatrix(const float* m){
+    PinholeParameters result;
+    result.fx = m[0];
+    result.fy = m[5];
+    result.cx = m[2];
+    result.cy = m[6];
+    return result;
+}
+
+/// Row-major 4x4 transformation, as stored in scannet *.sens files
+inline Eigen::Matrix4d transformationFromMatrix(const float* m){
+    Eigen::Matrix4d result;
+    for(int r = 0; r < 4; r++) for(int c = 0; c < 4; c++) result(r,c) = m[4*r+c];
+    return result;
+}
+
+class DepthRegistration {
+public:
+
+    /**
+     * @param depthToColor Rigid transformation from the depth to the colour camera, translation in metres
+     * @param metresPerDepthUnit Scale of depth values, e.g. 0.001 for depth in mm
+     */
+    DepthRegistration(const PinholeParameters& depthIntrinsics, cv::Size depthSize,
+                      const PinholeParameters& colorIntrinsics, cv::Size colorSize,
+                      const Eigen::Matrix4d& depthToColor = Eigen::Matrix4d::Identity(),
+                      double metresPerDepthUnit = 0.001) : depthSize(depthSize), colorSize(colorSize) {
+        if(depthIntrinsics.fx <= 0 || depthIntrinsics.fy <= 0 || colorIntrinsics.fx <= 0 || colorIntrinsics.fy <= 0)
+            throw std::invalid_argument("Invalid intrinsics, focal lengths have to be positive.");
+        if(metresPerDepthUnit <= 0) throw std::invalid_argument("Invalid depth scale.");
+
+        Eigen::Matrix3d K;
+        K << colorIntrinsics.fx, 0, colorIntrinsics.cx,
+             0, colorIntrinsics.fy, colorIntrinsics.cy,
+             0, 0, 1;
+        const Eigen::Matrix3d KR = K * depthToColor.topLeftCorner<3,3>();
+        const Eigen::Vector3d Kt = K * depthToColor.topRightCorner<3,1>() / metresPerDepthUnit;
+        offset = cv::Vec3f(Kt[0], Kt[1], Kt[2]);
+
+        table.create(depthSize, CV_32FC3);
+        for(int y = 0; y < depthSize.height; y++){
+            cv::Vec3f* row = table.ptr<cv::Vec3f>(y);
+            for(int x = 0; x < depthSize.width; x++){
+                const Eigen::Vector3d ray((x - depthIntrinsics.cx) / depthIntrinsics.fx, (y - depthIntrinsics.cy) / depthIntrinsics.fy, 1);
+                const Eigen::Vector3d r = KR * ray;
+                row[x] = cv::Vec3f(r[0], r[1], r[2]);
+            }
+        }
+
+        // Half the size of a depth pixel in the colour image, but at least half a pixel (nearest neighbour)
+        splatX = 0.5f * std::max(1.0, colorIntrinsics.fx / depthIntrinsics.fx);
+        splatY = 0.5f * std::max(1.0, colorIntrinsics.fy / depthIntrinsics.fy);
+    }
+
+    /**
+     * @brief Warp depth into the colour camera
+     * @param depth CV_16UC1 or CV_32FC1 depth image, 0 if invalid
+     * @param registered Receives the depth (of the same type and unit) seen from the colour camera, 0 if unknown
+     * @param parallel Process row bands in parallel. Disable this, if frames are already processed by a pool of threads.
+     */
+    void registerDepth(const cv::Mat& depth, cv::Mat& registered, bool parallel = true) const {
+        if(depth.size() != depthSize) throw std::invalid_argument("Depth image does not match the registration.");
+        registered.create(colorSize, depth.type());
+        if(depth.type() == CV_16UC1){
+            registered.setTo(std::numeric_limits<uint16_t>::max());
+            projectDepth<uint16_t, uint16_t>(depth, registered, parallel);
+            clearEmpty<uint16_t>(registered, std::numeric_limits<uint16_t>::max(), parallel);
+        } else if(depth.type() == CV_32FC1){
+            registered.setTo(std::numeric_limits<float>::infinity());
+            projectDepth<float, uint32_t>(depth, registered, parallel);
+            clearEmpty<float>(registered, std::numeric_limits<float>::infinity(), parallel);
+        } else {
+            throw std::invalid_argument("Depth has to be CV_16UC1 or CV_32FC1 data.");
+        }
+    }
+
+    /**
+     * @brief Warp colour into the depth camera, by looking up the colour of each depth pixel (bilinear). Occlusions are
+     * not handled, and pixels without depth are black.
+     * @param map Buffer (CV_32FC2), which is reused between calls
+     */
+    void registerColor(const cv::Mat& depth, const cv::Mat& color, cv::Mat& registered, cv::Mat& map, bool parallel = true) const {
+        if(depth.size() != depthSize) throw std::invalid_argument("Depth image does not match the registration.");
+        if(color.size() != colorSize) throw std::invalid_argument("Colour image does not match the registration.");
+        if(depth.type() == CV_16UC1) computeColorMap<uint16_t>(depth, map, parallel);
+        else if(depth.type() == CV_32FC1) computeColorMap<float>(depth, map, parallel);
+        else throw std::invalid_argument("Depth has to be CV_16UC1 or CV_32FC1 data.");
+        cv::remap(color, registered, map, cv::Mat(), cv::INTER_LINEAR, cv::BORDER_CONSTANT, cv::Scalar::all(0));
+    }
+
+    cv::Size getDepthSize() const { return depthSize; }
+    cv::Size getColorSize() const { return colorSize; }
+
+private:
+
+    static const int BAND_HEIGHT = 16;
+
+    template<typename T>
+    static bool atomicMin(T* target, T value){
+        T current = __atomic_load_n(target, __ATOMIC_RELAXED);
+        while(value < current)
+            if(__atomic_compare_exchange_n(target, &current, value, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) return true;
+        return false;
+    }
+
+    // Z-buffer keys have to be ordered like depth values. Positive floats are, when compared as integers.
+    static uint16_t toKey(float z, uint16_t){ return uint16_t(std::min(z + 0.5f, 65534.0f)); }
+    static uint32_t toKey(float z, uint32_t){
+        uint32_t key;
+        memcpy(&key, &z, sizeof(key));
+        return key;
+    }
+
+    template<typename T, typename Key>
+    void projectDepth(const cv::Mat& depth, cv::Mat& registered, bool parallel) const {
+        static_assert(sizeof(T) == sizeof(Key), "The z-buffer is stored in the output image.");
+        Key* zbuffer = (Key*)registered.data;
+        const size_t stride = registered.step / sizeof(Key);
+        const int numBands = (depth.rows + BAND_HEIGHT - 1) / BAND_HEIGHT;
+
+        #pragma omp parallel for schedule(dynamic) if(parallel)
+        for(int band = 0; band < numBands; band++){
+            const int yEnd = std::min(depth.rows, (band + 1) * BAND_HEIGHT);
+            for(int y = band * BAND_HEIGHT; y < yEnd; y++){
+                const T* d = depth.ptr<T>(y);
+                const cv::Vec3f* r = table.ptr<cv::Vec3f>(y);
+                for(int x = 0; x < depth.cols; x++){
+                    const float z = d[x];
+                    if(!(z > 0)) continue; // Also skips NaN
+                    const float w = z * r[x][2] + offset[2];
+                    if(w <= 0) continue;
+                    const float invW = 1.0f / w;
+                    const float u = (z * r[x][0] + offset[0]) * invW;
+                    const float v = (z * r[x][1] + offset[1]) * invW;
+                    // Also rejects non-finite coordinates (w close to 0), which could not be converted to int
+                    if(!(u > -splatX && u < colorSize.width + splatX && v > -splatY && v < colorSize.height + splatY)) continue;
+                    const int x0 = std::max(0, int(std::ceil(u - splatX)));
+                    const int x1 = std::min(colorSize.width, int(std::ceil(u + splatX)));
+                    const int y0 = std::max(0, int(std::ceil(v - splatY)));
+                    const int y1 = std::min(colorSize.height, int(std::ceil(v + splatY)));
+                    const Key key = toKey(w, Key());
+                    for(int ty = y0; ty < y1; ty++)
+                        for(int tx = x0; tx < x1; tx++)
+                            atomicMin(zbuffer + ty * stride + tx, key);
+                }
+            }
+        }
+    }
+
+    template<typename T>
+    static void clearEmpty(cv::Mat& registered, T empty, bool parallel){
+        #pragma omp parallel for if(parallel)
+        for(int y = 0; y < registered.rows; y++){
+            T* row = registered.ptr<T>(y);
+            for(int x = 0; x < registered.cols; x++) if(row[x] == empty) row[x] = 0;
+        }
+    }
+
+    template<typename T>
+    void computeColorMap(const cv::Mat& depth, cv::Mat& map, bool parallel) const {
+        map.create(depthSize, CV_32FC2);
+        const int numBands = (depth.rows + BAND_HEIGHT - 1) / BAND_HEIGHT;
+
+        #pragma omp parallel for if(parallel)
+        for(int band = 0; band < numBands; band++){
+            const int yEnd = std::min(depth.rows, (band + 1) * BAND_HEIGHT);
+            for(int y = band * BAND_HEIGHT; y < yEnd; y++){
+                const T* d = depth.ptr<T>(y);
+                const cv::Vec3f* r = table.ptr<cv::Vec3f>(y);
+                cv::Vec2f* m = map.ptr<cv::Vec2f>(y);
+                for(int x = 0; x < depth.cols; x++){
+                    const float z = d[x];
+                    const float w = z * r[x][2] + offset[2];
+                    if(!(z > 0) || w <= 0){
+                        m[x] = cv::Vec2f(-1, -1);
+                        continue;
+                    }
+                    const float invW = 1.0f / w;
+                    const float u = (z * r[x][0] + offset[0]) * invW;
+                    const float v = (z * r[x][1] + offset[1]) * invW;
+                    // Far outside coordinates (w close to 0) are marked invalid, as remap converts them to int
+                    const bool inside = u > -1 && u < colorSize.width && v > -1 && v < colorSize.height;
+                    m[x] = inside ? cv::Vec2f(u, v) : cv::Vec2f(-1, -1);
+                }
+            }
+        }
+    }
+
+    cv::Size depthSize;
+    cv::Size colorSize;
+    cv::Mat table; // CV_32FC3, per depth pixel: K_colour * R * ray
+    cv::Vec3f offset; // K_colour * t, in depth units
+    float splatX, splatY;
+};
+
+/**
+ * @brief Registration of scannet-style calibrations: Row-major 4x4 intrinsics and extrinsics, which transform each
+ * camera to a common frame.
+ */
+inline DepthRegistration createDepthRegistration(const float* depthIntrinsic, const float* depthExtrinsic, cv::Size depthSize,
+                                                 const float* colorIntrinsic, const float* colorExtrinsic, cv::Size colorSize,
+                                                 double metresPerDepthUnit){
+    const Eigen::Matrix4d depthToColor = transformationFromMatrix(colorExtrinsic).inverse() * transformationFromMatrix(depthExtrinsic);
+    return DepthRegistration(pinholeFromMatrix(depthIntrinsic), depthSize, pinholeFromMatrix(colorIntrinsic), colorSize,
+                             depthToColor, metresPerDepthUnit);
+}
@@ -0,0 +1,186 @@
+/******************************************************************
+This file is part of https://github.com/martinruenz/dataset-tools
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>
+*****************************************************************/
+
+/**
+ * Lossless run-length / variable-length (RVL) compression of 16-bit depth images, see:
+ * A. D. Wilson, "Fast Lossless Depth Image Compression", ISS 2017.
+ *
+ * The image is traversed in row-major order as alternating runs of zeros and non-zeros. Run lengths, as well as the
+ * zigzag-encoded differences between consecutive non-zero values, are stored as variable-length sequences of nibbles
+ * (3 data bits + 1 continuation bit). Nibbles are packed into 32-bit words, most significant nibble first.
+ *
+ * An encoded payload starts with a tag, which allows to tell RVL apart from raw and zlib compressed depth:
+ * char[4]: "RVL1"
+ * int32_t: width
+ * int32_t: height
+ * uint32_t[]: packed nibbles
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <vector>
+
+#include <opencv2/core/core.hpp>
+
+const size_t RVL_HEADER_SIZE = 4 + 2 * sizeof(int32_t);
+
+inline const char* rvlMagic() { return "RVL1"; }
+
+/// True, if 'data' starts with an RVL tag
+inline bool isRvlDepth(const unsigned char* data, size_t size){
+    return size >= RVL_HEADER_SIZE && memcmp(data, rvlMagic(), 4) == 0;
+}
+
+/// Read the image size that is stored in the tag of an RVL payload
+inline void readRvlSize(const unsigned char* data, size_t size, int& width, int& height){
+    if(!isRvlDepth(data, size)) throw std::invalid_argument("Data is not RVL compressed.");
+    memcpy(&width, data + 4, sizeof(int32_t));
+    memcpy(&height, data + 4 + sizeof(int32_t), sizeof(int32_t));
+}
+
+/**
+ * @brief Compress a CV_16UC1 depth image.
+ * @param out Compressed data, the vector is only reallocated if it is too small.
+ */
+inline void compressRvlDepth(const cv::Mat& depth, std::vector<unsigned char>& out){
+    if(depth.type() != CV_16UC1 || !depth.isContinuous()) throw std::invalid_argument("Depth has to be continuous CV_16UC1 data.");
+    const int32_t width = depth.cols;
+    const int32_t height = depth.rows;
+    const size_t numPixels = depth.total();
+
+    // Worst case: every pixel is a run of its own (1 nibble each), with a 17-bit delta (6 nibbles)
+    out.resize(RVL_HEADER_SIZE + (numPixels * 8 + 8) / 2 + sizeof(uint32_t));
+    memcpy(out.data(), rvlMagic(), 4);
+    memcpy(out.data() + 4, &width, sizeof(int32_t));
+    memcpy(out.data() + 4 + sizeof(int32_t), &height, sizeof(int32_t));
+
+    unsigned char* output = out.data() + RVL_HEADER_SIZE;
+    uint32_t word = 0;
+    int numNibbles = 0;
+    auto encode = [&](uint32_t value){
+        do {
+            uint32_t nibble = value & 0x7;
+            value >>= 3;
+            if(value) nibble |= 0x8;
+            word = (word << 4) | nibble;
+            if(++numNibbles == 8){
+                memcpy(output, &word, sizeof(uint32_t));
+                output += sizeof(uint32_t);
+                word = 0;
+                numNibbles = 0;
+            }
+        } while(value);
+    };
+
+    const uint16_t* input = depth.ptr<uint16_t>();
+    const uint16_t* end = input + numPixels;
+    int previous = 0;
+    while(input != end){
+        const uint16_t* runStart = input;
+        while(input != end && *input == 0) input++;
+        encode(input - runStart);
+
+        runStart = input;
+        while(input != end && *input != 0) input++;
+        encode(input - runStart);
+
+        for(const uint16_t* p = runStart; p != input; p++){
+            const int delta = int(*p) - previous;
+            encode((uint32_t(delta) << 1) ^ uint32_t(delta >> 31));
+            previous = *p;
+        }
+    }
+    if(numNibbles){
+        word <<= 4 * (8 - numNibbles);
+        memcpy(output, &word, sizeof(uint32_t));
+        output += sizeof(uint32_t);
+    }
+
+    // Payloads are told apart from raw depth by their size, hence avoid the (unlikely) collision
+    if(size_t(output - out.data()) == numPixels * 2){
+        memset(output, 0, sizeof(uint32_t));
+        output += sizeof(uint32_t);
+    }
+    out.resize(output - out.data());
+}
+
+/**
+ * @brief Decompress an RVL payload into 'depth', which has to provide space for 'numPixels' values.
+ */
+inline void decompressRvlDepth(const unsigned char* data, size_t size, uint16_t* depth, size_t numPixels){
+    int width, height;
+    readRvlSize(data, size, width, height);
+    if(width < 0 || height < 0 || size_t(width) * size_t(height) != numPixels)
+        throw std::invalid_argument("RVL image size does not match.");
+
+    const unsigned char* input = data + RVL_HEADER_SIZE;
+    const unsigned char* inputEnd = data + size;
+    uint32_t word = 0;
+    int numNibbles = 0;
+    auto decode = [&]() -> uint32_t {
+        uint32_t value = 0;
+        int shift = 0;
+        uint32_t nibble;
+        do {
+            if(numNibbles == 0){
+                if(inputEnd - input < (ptrdiff_t)sizeof(uint32_t)) throw std::invalid_argument("RVL data is truncated.");
+                memcpy(&word, input, sizeof(uint32_t));
+                input += sizeof(uint32_t);
+                numNibbles = 8;
+            }
+            nibble = word >> 28;
+            word <<= 4;
+            numNibbles--;
+            if(shift > 30) throw std::invalid_argument("RVL data is corrupt.");
+            value |= (nibble & 0x7) << shift;
+            shift += 3;
+        } while(nibble & 0x8);
+        return value;
+    };
+
+    uint16_t* output = depth;
+    uint16_t* end = depth + numPixels;
+    int previous = 0;
+    while(output != end){
+        uint32_t zeros = decode();
+        if(zeros > size_t(end - output)) throw std::invalid_argument("RVL data is corrupt.");
+        memset(output, 0, zeros * sizeof(uint16_t));
+        output += zeros;
+
+        uint32_t nonZeros = decode();
+        if(nonZeros > size_t(end - output)) throw std::invalid_argument("RVL data is corrupt.");
+        for(uint32_t i = 0; i < nonZeros; i++){
+            const uint32_t positive = decode();
+            const int delta = int(positive >> 1) ^ -int(positive & 1);
+            previous += delta;
+            *output++ = uint16_t(previous);
+        }
+    }
+}
+
+/**
+ * @brief Decompress an RVL payload into a CV_16UC1 matrix, which is (re)allocated only if required.
+ */
+inline void decompressRvlDepth(const unsigned char* data, size_t size, cv::Mat& depth){
+    int width, height;
+    readRvlSize(data, size, width, height);
+    depth.create(height, width, CV_16UC1);
+    decompressRvlDepth(data, size, depth.ptr<uint16_t>(), depth.total());
+}
@@ -0,0 +1,689 @@
+/******************************************************************
+This file is part of https://github.com/martinruenz/dataset-tools
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>
+*****************************************************************/
+
+/**
+ * Streaming reader for ScanNet *.sens files (version 4), see ../external/scannet/sensorData.h.
+ *
+ * *.sens files start with:
+ * uint32_t: version (4)
+ * uint64_t: length of sensor name, followed by the name
+ * 2 * 2 * float[16]: colour calibration (intrinsic, extrinsic), depth calibration (intrinsic, extrinsic)
+ * int32_t: colour compression type, int32_t: depth compression type
+ * uint32_t: colour width, colour height, depth width, depth height
+ * float: depth shift (depth units per metre)
+ * uint64_t: frame count
+ *
+ * Afterwards, for each frame:
+ * float[16]: camera-to-world transformation (row-major)
+ * uint64_t: colour timestamp, depth timestamp (typically in microseconds)
+ * uint64_t: colour size, depth size
+ * colour size * unsigned char: compressed colour, depth size * unsigned char: compressed depth
+ *
+ * IMU frames, which follow the last frame, are not read.
+ *
+ * Unlike ml::SensorData, which loads all frames into memory, SensReader maps the file and locates frames on demand.
+ * Frame headers are walked lazily, up to the highest frame that was requested so far, hence the first frame is
+ * available right after opening the file, and memory use is bounded by the frames in use (mapped pages are backed by
+ * the file and can be dropped by the kernel at any time).
+ *
+ * Frames are decoded with libjpeg(-turbo) and zlib, or libdeflate if SENS_WITH_LIBDEFLATE is defined, straight into the
+ * caller's buffers. If SENS_WITHOUT_LIBJPEG or SENS_WITHOUT_ZLIB is defined, stb_image (as used by ml::SensorData) is
+ * used instead. See ../convert_scannet_sens/CMakeLists.txt, which detects the libraries.
+ *
+ * SensWriter writes frames sequentially, ParallelSensWriter encodes them on a pool of workers and writes them in order.
+ */
+
+#pragma once
+
+#ifndef SENS_WITHOUT_LIBJPEG
+#include "JPEGLoader.h"
+#endif
+#include "common_threading.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <limits>
+#include <mutex>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <opencv2/core/core.hpp>
+#include <opencv2/imgcodecs/imgcodecs.hpp>
+#include <opencv2/imgproc/imgproc.hpp>
+#if defined(SENS_WITH_LIBDEFLATE)
+#include <libdeflate.h>
+#elif !defined(SENS_WITHOUT_ZLIB)
+#include <zlib.h>
+#endif
+
+namespace sens_stb {
+#define STB_IMAGE_STATIC
+#define STBI_ONLY_JPEG
+#define STBI_ONLY_PNG
+#define STB_IMAGE_IMPLEMENTATION
+#include "../external/scannet/sensorData/stb_image.h"
+#undef STB_IMAGE_IMPLEMENTATION
+#undef STBI_ONLY_PNG
+#undef STBI_ONLY_JPEG
+#undef STB_IMAGE_STATIC
+}
+
+enum class SensColorCodec : int32_t { Unknown = -1, Raw = 0, Png = 1, Jpeg = 2 };
+enum class SensDepthCodec : int32_t { Unknown = -1, Raw = 0, Zlib = 1, Occi = 2 };
+
+const uint32_t SENS_VERSION = 4;
+const size_t SENS_FRAME_HEADER_SIZE = 16 * sizeof(float) + 4 * sizeof(uint64_t);
+
+struct SensCalibration {
+    float intrinsic[16];
+    float extrinsic[16];
+};
+
+/// File header, without the frame count
+struct SensHeader {
+    uint32_t version = SENS_VERSION;
+    std::string sensorName;
+    SensCalibration calibrationColor;
+    SensCalibration calibrationDepth;
+    SensColorCodec colorCodec = SensColorCodec::Unknown;
+    SensDepthCodec depthCodec = SensDepthCodec::Unknown;
+    uint32_t colorWidth = 0;
+    uint32_t colorHeight = 0;
+    uint32_t depthWidth = 0;
+    uint32_t depthHeight = 0;
+    float depthShift = 1000; // Depth units per metre
+};
+
+struct SensFrameInfo {
+    uint64_t offset; // Offset of the frame header
+    float cameraToWorld[16];
+    uint64_t timeStampColor;
+    uint64_t timeStampDepth;
+    uint64_t colorSize;
+    uint64_t depthSize;
+
+    uint64_t colorOffset() const { return offset + SENS_FRAME_HEADER_SIZE; }
+    uint64_t depthOffset() const { return colorOffset() + colorSize; }
+    uint64_t endOffset() const { return depthOffset() + depthSize; }
+};
+
+/// Decode a JPEG or PNG image into 'bgr' (which has to be allocated with the size of the image) with stb_image.
+inline void decodeImageStb(const unsigned char* data, size_t size, cv::Mat& bgr){
+    int w, h;
+    unsigned char* decoded = sens_stb::stbi_load_from_memory(data, int(size), &w, &h, nullptr, 3);
+    if(!decoded) throw std::runtime_error("Could not decode image: " + std::string(sens_stb::stbi_failure_reason()));
+    if(w != bgr.cols || h != bgr.rows){
+        sens_stb::stbi_image_free(decoded);
+        throw std::runtime_error("Unexpected image size.");
+    }
+    cv::cvtColor(cv::Mat(h, w, CV_8UC3, decoded), bgr, cv::COLOR_RGB2BGR);
+    sens_stb::stbi_image_free(decoded);
+}
+
+/// Inflate zlib data into 'out' with stb_image. Returns false, if the data is invalid or does not have 'outSize' bytes.
+inline bool inflateStb(const unsigned char* data, size_t size, unsigned char* out, size_t outSize){
+    return sens_stb::stbi_zlib_decode_buffer((char*)out, int(outSize), (const char*)data, int(size)) == int(outSize);
+}
+
+/**
+ * @brief Decoder state, which is reused for all frames. A decoder must not be shared between threads, use one
+ * decoder per thread instead.
+ */
+class SensDecoder {
+public:
+    SensDecoder(){
+#ifdef SENS_WITH_LIBDEFLATE
+        deflate = libdeflate_alloc_decompressor();
+        if(!deflate) throw std::runtime_error("Could not allocate decompressor.");
+#endif
+    }
+
+    ~SensDecoder(){
+#ifdef SENS_WITH_LIBDEFLATE
+        libdeflate_free_decompressor(deflate);
+#endif
+    }
+
+    SensDecoder(const SensDecoder&) = delete;
+    SensDecoder& operator=(const SensDecoder&) = delete;
+
+    /// Decode a JPEG image into 'bgr', which has to be allocated with the size of the image.
+    void decodeJpeg(const unsigned char* data, size_t size, cv::Mat& bgr){
+#ifndef SENS_WITHOUT_LIBJPEG
+        jpeg.decode(data, size, bgr.data, bgr.cols, bgr.rows, true, bgr.step);
+#else
+        decodeImageStb(data, size, bgr);
+#endif
+    }
+
+    /// Inflate zlib data into 'out'. Returns false, if the data is invalid or does not have 'outSize' bytes.
+    bool inflate(const unsigned char* data, size_t size, unsigned char* out, size_t outSize){
+#if defined(SENS_WITH_LIBDEFLATE)
+        return libdeflate_zlib_decompress(deflate, data, size, out, outSize, nullptr) == LIBDEFLATE_SUCCESS;
+#elif !defined(SENS_WITHOUT_ZLIB)
+        uLongf length = outSize;
+        return uncompress(out, &length, data, size) == Z_OK && length == outSize;
+#else
+        return inflateStb(data, size, out, outSize);
+#endif
+    }
+
+    /// Names of the codec libraries in use
+    static std::string describe(){
+        std::string jpegCodec = "stb_image", zlibCodec = "stb_image";
+#ifndef SENS_WITHOUT_LIBJPEG
+        jpegCodec = "libjpeg";
+#endif
+#if defined(SENS_WITH_LIBDEFLATE)
+        zlibCodec = "libdeflate";
+#elif !defined(SENS_WITHOUT_ZLIB)
+        zlibCodec = "zlib";
+#endif
+        return "JPEG: " + jpegCodec + ", zlib: " + zlibCodec;
+    }
+
+private:
+#ifndef SENS_WITHOUT_LIBJPEG
+    JPEGLoader jpeg;
+#endif
+#ifdef SENS_WITH_LIBDEFLATE
+    libdeflate_decompressor* deflate = nullptr;
+#endif
+};
+
+class SensReader : public SensHeader {
+public:
+
+    SensReader(const std::string& path) : path(path) {
+        fd = open(path.c_str(), O_RDONLY);
+        if(fd < 0) throw std::invalid_argument("Could not open sens file: " + path);
+        struct stat st;
+        if(fstat(fd, &st) != 0 || st.st_size == 0){
+            close(fd);
+            throw std::invalid_argument("Could not read sens file: " + path);
+        }
+        fileSize = st.st_size;
+        mapping = (unsigned char*)mmap(nullptr, fileSize, PROT_READ, MAP_PRIVATE, fd, 0);
+        if(mapping == MAP_FAILED){
+            close(fd);
+            throw std::runtime_error("Could not map sens file: " + path);
+        }
+
+        try {
+            readHeader();
+        } catch(...) {
+            munmap(mapping, fileSize);
+            close(fd);
+            throw;
+        }
+    }
+
+    ~SensReader(){
+        munmap(mapping, fileSize);
+        close(fd);
+    }
+
+    SensReader(const SensReader&) = delete;
+    SensReader& operator=(const SensReader&) = delete;
+
+    const std::string& getPath() const { return path; }
+    uint64_t getFileSize() const { return fileSize; }
+    size_t numFrames() const { return frameCount; }
+
+    /**
+     * @brief Header of frame i. Frame headers are located on first use, this is thread-safe.
+     * @throw std::runtime_error if the file is truncated before the end of frame i
+     */
+    const SensFrameInfo& frameInfo(size_t i) const {
+        if(i >= frameCount) throw std::out_of_range("Frame " + std::to_string(i) + " does not exist.");
+        if(i < numScanned.load(std::memory_order_acquire)) return frames[i];
+
+        std::lock_guard<std::mutex> lock(scanMutex);
+        size_t n = numScanned.load(std::memory_order_relaxed);
+        uint64_t offset = n ? frames[n-1].endOffset() : firstFrameOffset;
+        for(; n <= i; n++){
+            SensFrameInfo info;
+            info.offset = offset;
+            if(offset + SENS_FRAME_HEADER_SIZE > fileSize) throw std::runtime_error("Sens file is truncated at frame " + std::to_string(n) + ".");
+            const unsigned char* p = mapping + offset;
+            memcpy(info.cameraToWorld, p, sizeof(info.cameraToWorld));
+            p += sizeof(info.cameraToWorld);
+            memcpy(&info.timeStampColor, p, 4 * sizeof(uint64_t));
+            if(info.colorSize > fileSize || info.depthSize > fileSize || info.endOffset() > fileSize)
+                throw std::runtime_error("Sens file is truncated at frame " + std::to_string(n) + ".");
+            frames.push_back(info);
+            offset = info.endOffset();
+            numScanned.store(n + 1, std::memory_order_release);
+        }
+        return frames[i];
+    }
+
+    /**
+     * @brief Locate all frame headers, without reading any payloads. This is what analysing timestamps, poses or the
+     * integrity of a file needs, and only costs one page per frame, since readahead is disabled meanwhile.
+     * @return Number of complete frames, which is less than numFrames() if the file is truncated
+     */
+    size_t scanHeaders() const {
+        madvise(mapping, fileSize, MADV_RANDOM);
+        try {
+            if(frameCount) frameInfo(frameCount - 1);
+        } catch(const std::runtime_error&) {
+            // Truncated, numScanned is the number of complete frames
+        }
+        madvise(mapping, fileSize, MADV_NORMAL);
+        return numScanned.load();
+    }
+
+    const unsigned char* colorData(size_t i) const { return mapping + frameInfo(i).colorOffset(); }
+    const unsigned char* depthData(size_t i) const { return mapping + frameInfo(i).depthOffset(); }
+
+    /// Ask the kernel to read the payloads of frame i ahead of their use (non-blocking)
+    void prefetch(size_t i) const {
+        const SensFrameInfo& info = frameInfo(i);
+        const uint64_t pageSize = sysconf(_SC_PAGESIZE);
+        const uint64_t begin = info.offset / pageSize * pageSize;
+        madvise(mapping + begin, info.endOffset() - begin, MADV_WILLNEED);
+    }
+
+    /**
+     * @brief Decode the colour image of frame i into 'rgb' (BGR order, as used by OpenCV), which is only (re)allocated
+     * if required.
+     */
+    void readColor(size_t i, cv::Mat& rgb, SensDecoder& decoder) const {
+        const SensFrameInfo& info = frameInfo(i);
+        rgb.create(colorHeight, colorWidth, CV_8UC3);
+        if(colorCodec == SensColorCodec::Jpeg){
+            decoder.decodeJpeg(colorData(i), info.colorSize, rgb);
+        } else if(colorCodec == SensColorCodec::Raw){
+            if(info.colorSize != rgb.total() * 3) throw std::runtime_error("Invalid colour data of frame " + std::to_string(i) + ".");
+            cv::cvtColor(cv::Mat(colorHeight, colorWidth, CV_8UC3, (void*)colorData(i)), rgb, cv::COLOR_RGB2BGR);
+        } else {
+            rgb = cv::imdecode(cv::Mat(1, info.colorSize, CV_8UC1, (void*)colorData(i)), cv::IMREAD_COLOR);
+            if(rgb.empty()) throw std::runtime_error("Could not decode colour of frame " + std::to_string(i) + ".");
+        }
+    }
+
+    /// Decode the depth image of frame i into 'depth' (CV_16UC1, see depthShift), which is only (re)allocated if required.
+    void readDepth(size_t i, cv::Mat& depth, SensDecoder& decoder) const {
+        const SensFrameInfo& info = frameInfo(i);
+        depth.create(depthHeight, depthWidth, CV_16UC1);
+        const size_t size = depth.total() * 2;
+        if(depthCodec == SensDepthCodec::Zlib){
+            if(!decoder.inflate(depthData(i), info.depthSize, depth.data, size))
+                throw std::runtime_error("Could not decompress depth of frame " + std::to_string(i) + ".");
+        } else if(depthCodec == SensDepthCodec::Raw && info.depthSize == size){
+            memcpy(depth.data, depthData(i), size);
+        } else {
+            throw std::runtime_error("Unsupported depth data of frame " + std::to_string(i) + ".");
+        }
+    }
+
+    friend std::ostream& operator<<(std::ostream& s, const SensReader& r){
+        return s << "Sens file: " << r.path << "\n"
+                 << "Version: " << r.version << "\n"
+                 << "Sensor: " << r.sensorName << "\n"
+                 << "Colour: " << r.colorWidth << "x" << r.colorHeight << ", codec " << int(r.colorCodec) << "\n"
+                 << "Depth: " << r.depthWidth << "x" << r.depthHeight << ", codec " << int(r.depthCodec) << ", shift " << r.depthShift << "\n"
+                 << "Frames: " << r.frameCount << "\n";
+    }
+
+private:
+
+    template<typename T>
+    void read(uint64_t& offset, T* value, size_t count = 1){
+        if(offset + sizeof(T) * count > fileSize) throw std::invalid_argument("Sens file is too small: " + path);
+        memcpy(value, mapping + offset, sizeof(T) * count);
+        offset += sizeof(T) * count;
+    }
+
+    void readHeader(){
+        uint64_t offset = 0;
+        read(offset, &version);
+        if(version != SENS_VERSION)
+            throw std::invalid_argument("Invalid sens file version " + std::to_string(version) + ", expected " + std::to_string(SENS_VERSION) + ": " + path);
+        uint64_t nameLength;
+        read(offset, &nameLength);
+        if(nameLength > fileSize) throw std::invalid_argument("Invalid sens file header: " + path);
+        sensorName.resize(nameLength);
+        read(offset, &sensorName[0], nameLength);
+        read(offset, &calibrationColor);
+        read(offset, &calibrationDepth);
+        read(offset, &colorCodec);
+        read(offset, &depthCodec);
+        read(offset, &colorWidth);
+        read(offset, &colorHeight);
+        read(offset, &depthWidth);
+        read(offset, &depthHeight);
+        read(offset, &depthShift);
+        uint64_t count;
+        read(offset, &count);
+        frameCount = count;
+        firstFrameOffset = offset;
+        // Every frame needs at least a header, hence this is enough for all frames that can exist (also if the file is
+        // truncated or the count is corrupt). The vector is never reallocated, references to frames stay valid.
+        frames.reserve(std::min<uint64_t>(count, (fileSize - offset) / SENS_FRAME_HEADER_SIZE));
+    }
+
+    std::string path;
+    int fd = -1;
+    uint64_t fileSize = 0;
+    unsigned char* mapping = nullptr;
+    size_t frameCount = 0;
+    uint64_t firstFrameOffset = 0;
+
+    mutable std::vector<SensFrameInfo> frames;
+    mutable std::atomic<size_t> numScanned{0};
+    mutable std::mutex scanMutex;
+};
+
+/**
+ * @brief Write *.sens files frame by frame. The frame count is patched and an empty list of IMU frames is appended
+ * when closing the file.
+ */
+class SensWriter {
+public:
+
+    SensWriter(const std::string& path, const SensHeader& header) : path(path) {
+        out.open(path, std::ofstream::binary);
+        if(!out.is_open()) throw std::invalid_argument("Could not open output file: " + path);
+        const uint64_t nameLength = header.sensorName.size();
+        out.write((const char*)&header.version, sizeof(header.version));
+        out.write((const char*)&nameLength, sizeof(nameLength));
+        out.write(header.sensorName.data(), nameLength);
+        out.write((const char*)&header.calibrationColor, sizeof(SensCalibration));
+        out.write((const char*)&header.calibrationDepth, sizeof(SensCalibration));
+        out.write((const char*)&header.colorCodec, sizeof(header.colorCodec));
+        out.write((const char*)&header.depthCodec, sizeof(header.depthCodec));
+        out.write((const char*)&header.colorWidth, sizeof(header.colorWidth));
+        out.write((const char*)&header.colorHeight, sizeof(header.colorHeight));
+        out.write((const char*)&header.depthWidth, sizeof(header.depthWidth));
+        out.write((const char*)&header.depthHeight, sizeof(header.depthHeight));
+        out.write((const char*)&header.depthShift, sizeof(header.depthShift));
+        frameCountOffset = out.tellp();
+        out.write((const char*)&frameCount, sizeof(frameCount));
+        if(!out) throw std::runtime_error("Could not write to sens file: " + path);
+    }
+
+    ~SensWriter(){
+        try {
+            close();
+        } catch(...) {}
+    }
+
+    SensWriter(const SensWriter&) = delete;
+    SensWriter& operator=(const SensWriter&) = delete;
+
+    /// Append a frame, with colour and depth compressed as announced in the header
+    void writeFrame(const float cameraToWorld[16], uint64_t timeStampColor, uint64_t timeStampDepth,
+                    const void* color, uint64_t colorSize, const void* depth, uint64_t depthSize){
+        if(!out.is_open()) throw std::runtime_error("Sens file has already been closed: " + path);
+        out.write((const char*)cameraToWorld, 16 * sizeof(float));
+        out.write((const char*)&timeStampColor, sizeof(timeStampColor));
+        out.write((const char*)&timeStampDepth, sizeof(timeStampDepth));
+        out.write((const char*)&colorSize, sizeof(colorSize));
+        out.write((const char*)&depthSize, sizeof(depthSize));
+        out.write((const char*)color, colorSize);
+        out.write((const char*)depth, depthSize);
+        if(!out) throw std::runtime_error("Could not write to sens file: " + path);
+        frameCount++;
+    }
+
+    void close(){
+        if(!out.is_open()) return;
+        const uint64_t numIMUFrames = 0;
+        out.write((const char*)&numIMUFrames, sizeof(numIMUFrames));
+        out.seekp(frameCountOffset);
+        out.write((const char*)&frameCount, sizeof(frameCount));
+        out.close(); // Flushes, failures set the failbit as well
+        if(!out) throw std::runtime_error("Could not write to sens file: " + path);
+    }
+
+    uint64_t numFrames() const { return frameCount; }
+
+private:
+    std::string path;
+    std::ofstream out;
+    std::streamoff frameCountOffset = 0;
+    uint64_t frameCount = 0;
+};
+
+/**
+ * @brief Encoder state, which is reused for all frames. Like SensDecoder, an encoder must not be shared between threads.
+ */
+class SensEncoder {
+public:
+    SensEncoder(int jpegQuality = 90) : jpegQuality(jpegQuality) {
+#ifdef SENS_WITH_LIBDEFLATE
+        deflate = libdeflate_alloc_compressor(1);
+        if(!deflate) throw std::runtime_error("Could not allocate compressor.");
+#endif
+    }
+
+    ~SensEncoder(){
+#ifdef SENS_WITH_LIBDEFLATE
+        libdeflate_free_compressor(deflate);
+#endif
+    }
+
+    SensEncoder(const SensEncoder&) = delete;
+    SensEncoder& operator=(const SensEncoder&) = delete;
+
+    /// Encode a BGR image (CV_8UC3)
+    void encodeColor(const cv::Mat& bgr, SensColorCodec codec, std::vector<unsigned char>& out){
+        if(bgr.type() != CV_8UC3) throw std::invalid_argument("Colour has to be CV_8UC3 data.");
+        if(codec == SensColorCodec::Jpeg){
+            if(!cv::imencode(".jpg", bgr, out, { cv::IMWRITE_JPEG_QUALITY, jpegQuality })) throw std::runtime_error("Could not encode colour image.");
+        } else if(codec == SensColorCodec::Png){
+            if(!cv::imencode(".png", bgr, out)) throw std::runtime_error("Could not encode colour image.");
+        } else if(codec == SensColorCodec::Raw){
+            // ml::SensorData stores raw colour in RGB order
+            cv::cvtColor(bgr, rgb, cv::COLOR_BGR2RGB);
+            out.assign(rgb.data, rgb.data + rgb.total() * rgb.elemSize());
+        } else {
+            throw std::invalid_argument("Unsupported colour codec.");
+        }
+    }
+
+    /// Encode a depth image (CV_16UC1)
+    void encodeDepth(const cv::Mat& depth, SensDepthCodec codec, std::vector<unsigned char>& out){
+        if(depth.type() != CV_16UC1 || !depth.isContinuous()) throw std::invalid_argument("Depth has to be continuous CV_16UC1 data.");
+        const size_t size = depth.total() * depth.elemSize();
+        if(codec == SensDepthCodec::Raw){
+            out.assign(depth.data, depth.data + size);
+        } else if(codec == SensDepthCodec::Zlib){
+#if defined(SENS_WITH_LIBDEFLATE)
+            out.resize(libdeflate_zlib_compress_bound(deflate, size));
+            const size_t compressedSize = libdeflate_zlib_compress(deflate, depth.data, size, out.data(), out.size());
+            if(compressedSize == 0) throw std::runtime_error("Could not compress depth image.");
+            out.resize(compressedSize);
+#elif !defined(SENS_WITHOUT_ZLIB)
+            uLongf compressedSize = compressBound(size);
+            out.resize(compressedSize);
+            if(compress2(out.data(), &compressedSize, depth.data, size, Z_BEST_SPEED) != Z_OK) throw std::runtime_error("Could not compress depth image.");
+            out.resize(compressedSize);
+#else
+            throw std::runtime_error("Compressing depth requires zlib or libdeflate.");
+#endif
+        } else {
+            throw std::invalid_argument("Unsupported depth codec.");
+        }
+    }
+
+private:
+    int jpegQuality;
+    cv::Mat rgb;
+#ifdef SENS_WITH_LIBDEFLATE
+    libdeflate_compressor* deflate = nullptr;
+#endif
+};
+
+/// A frame, which is handed to ParallelSensWriter
+struct SensWriterFrame {
+    SensWriterFrame(){ std::fill(cameraToWorld, cameraToWorld + 16, -std::numeric_limits<float>::infinity()); }
+
+    cv::Mat color; // CV_8UC3, BGR, encoded with the colour codec of the header
+    cv::Mat depth; // CV_16UC1, in depth units (see SensHeader::depthShift), encoded with the depth codec of the header
+    std::vector<unsigned char> colorEncoded; // Written as-is, if 'color' is empty
+    std::vector<unsigned char> depthEncoded; // Written as-is, if 'depth' is empty
+    float cameraToWorld[16]; // Row-major, invalid (-inf) by default, like in scannet
+    uint64_t timeStampColor = 0;
+    uint64_t timeStampDepth = 0;
+};
+
+/**
+ * @brief Write *.sens files, while frames are encoded by a pool of workers.
+ *
+ * write() hands a frame (or a function that loads it) to the workers and returns immediately, unless the queue is
+ * full, in which case it blocks until a worker is free. The encoded frames are written in order by a separate thread,
+ * hence the caller never waits for the disk. Errors of the workers or the file are re-thrown by write() or close().
+ */
+class ParallelSensWriter {
+public:
+    typedef std::function<void(SensWriterFrame&)> Loader;
+
+    ParallelSensWriter(const std::string& path, const SensHeader& header, size_t numThreads = defaultThreadCount(), int jpegQuality = 90)
+        : header(header), writer(path, header), tasks(2 * std::max<size_t>(1, numThreads)), encoded(2 * std::max<size_t>(1, numThreads)),
+          window(4 * std::max<size_t>(1, numThreads)) {
+        numThreads = std::max<size_t>(1, numThreads);
+        activeWorkers = numThreads;
+        for(size_t t = 0; t < numThreads; t++) threads.emplace_back([this, jpegQuality](){ encode(jpegQuality); });
+        threads.emplace_back([this](){ writeEncoded(); });
+    }
+
+    ~ParallelSensWriter(){
+        try {
+            close();
+        } catch(...) {}
+    }
+
+    ParallelSensWriter(const ParallelSensWriter&) = delete;
+    ParallelSensWriter& operator=(const ParallelSensWriter&) = delete;
+
+    /// Queue a frame. The images are shared, not copied, and must not be modified by the caller afterwards.
+    void write(SensWriterFrame frame){
+        Task task;
+        task.frame = std::move(frame);
+        push(std::move(task));
+    }
+
+    /// Queue a frame, which is loaded by 'load' on one of the workers (e.g. read from image files)
+    void write(Loader load){
+        Task task;
+        task.load = std::move(load);
+        push(std::move(task));
+    }
+
+    /// Wait for all queued frames, patch the frame count and close the file
+    void close(){
+        if(closed) return;
+        closed = true;
+        tasks.close();
+        for(std::thread& t : threads) t.join();
+        errors.capture([&](){ writer.close(); });
+        errors.rethrow();
+    }
+
+    /// Number of written frames, which is final after close()
+    uint64_t numFrames() const { return writer.numFrames(); }
+
+private:
+    struct Task {
+        size_t index = 0;
+        SensWriterFrame frame;
+        Loader load;
+    };
+
+    void push(Task task){
+        if(closed) throw std::runtime_error("Sens writer has already been closed.");
+        task.index = numQueued;
+        if(!window.acquire() || !tasks.push(std::move(task))){
+            close();
+            throw std::runtime_error("Sens writer failed.");
+        }
+        numQueued++;
+    }
+
+    void closeQueues(){
+        tasks.close();
+        encoded.close();
+        window.close();
+    }
+
+    void encode(int jpegQuality){
+        SensEncoder encoder(jpegQuality);
+        if(!errors.capture([&](){
+            Task task;
+            while(tasks.pop(task)){
+                SensWriterFrame& f = task.frame;
+                if(task.load) task.load(f);
+                task.load = nullptr;
+                if(!f.color.empty()){
+                    if(f.color.cols != int(header.colorWidth) || f.color.rows != int(header.colorHeight))
+                        throw std::invalid_argument("Colour of frame " + std::to_string(task.index) + " does not match the size in the header.");
+                    encoder.encodeColor(f.color, header.colorCodec, f.colorEncoded);
+                    f.color.release();
+                }
+                if(!f.depth.empty()){
+                    if(f.depth.cols != int(header.depthWidth) || f.depth.rows != int(header.depthHeight))
+                        throw std::invalid_argument("Depth of frame " + std::to_string(task.index) + " does not match the size in the header.");
+                    encoder.encodeDepth(f.depth, header.depthCodec, f.depthEncoded);
+                    f.depth.release();
+                }
+                if(!encoded.push(std::move(task))) break;
+            }
+        })) closeQueues();
+        if(--activeWorkers == 0) encoded.close();
+    }
+
+    void writeEncoded(){
+        ReorderBuffer<Task> order;
+        if(!errors.capture([&](){
+            Task task;
+            while(encoded.pop(task)){
+                const size_t index = task.index;
+                order.push(index, std::move(task), [&](const Task& t){
+                    const SensWriterFrame& f = t.frame;
+                    writer.writeFrame(f.cameraToWorld, f.timeStampColor, f.timeStampDepth,
+                                      f.colorEncoded.data(), f.colorEncoded.size(), f.depthEncoded.data(), f.depthEncoded.size());
+                    window.release();
+                });
+            }
+        })) closeQueues();
+    }
+
+    const SensHeader header;
+    SensWriter writer;
+    BoundedQueue<Task> tasks;
+    BoundedQueue<Task> encoded;
+    ReorderWindow window; // Frames ahead of the writer thread
+    ThreadErrors errors;
+    std::atomic<size_t> activeWorkers{0};
+    std::vector<std::thread> threads;
+    size_t numQueued = 0;
+    bool closed = false;
+};
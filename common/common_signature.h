@@ -0,0 +1,187 @@
+/******************************************************************
+This file is part of https://github.com/martinruenz/dataset-tools
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>
+*****************************************************************/
+
+/**
+ * Cheap per-frame signatures, used to find static and near-duplicate frames of RGB-D sequences.
+ *
+ * A signature consists of a small greyscale and depth thumbnail, and a 64-bit difference hash of the greyscale
+ * thumbnail. Frames are compared by the mean absolute difference (SAD) of their thumbnails, which cv::norm computes
+ * with vectorised code, and optionally by the relative motion of their camera poses.
+ */
+
+#pragma once
+
+#include "common_3d.h"
+#include "common_filesystem.h"
+
+#include <opencv2/imgproc/imgproc.hpp>
+#include <cmath>
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+
+struct FrameSignature {
+    cv::Mat grey;  // CV_8UC1 thumbnail of the colour image
+    cv::Mat depth; // CV_32FC1 thumbnail of the depth image [m], 0 if invalid
+    uint64_t hash = 0;
+};
+
+/**
+ * @brief Difference between two frames. Depth is only compared where both thumbnails are valid.
+ */
+struct FrameChange {
+    double grey = 0;          // Mean absolute difference [grey levels]
+    double depth = 0;         // Mean absolute difference [m]
+    int hashDistance = 0;     // Number of differing hash bits
+    double translation = 0;   // [m], only if poses are compared
+    double rotation = 0;      // [deg], only if poses are compared
+};
+
+/**
+ * @brief Compute the signature of a frame
+ * @param rgb 8-bit colour image (channel order does not matter, as long as it is the same for all frames) or empty
+ * @param depthMetric CV_32FC1 depth image in metres, or empty
+ * @param thumbnailSize Size of thumbnails, 32x24 works well for 4:3 images
+ */
+inline FrameSignature computeFrameSignature(const cv::Mat& rgb, const cv::Mat& depthMetric, cv::Size thumbnailSize = cv::Size(32, 24)){
+    FrameSignature result;
+    if(!rgb.empty()){
+        cv::Mat grey;
+        if(rgb.channels() == 3) cv::cvtColor(rgb, grey, cv::COLOR_RGB2GRAY);
+        else grey = rgb;
+        cv::resize(grey, result.grey, thumbnailSize, 0, 0, cv::INTER_AREA);
+
+        // Difference hash: one bit per horizontal gradient of a 9x8 thumbnail
+        cv::Mat small;
+        cv::resize(grey, small, cv::Size(9, 8), 0, 0, cv::INTER_AREA);
+        for(int y = 0; y < 8; y++)
+            for(int x = 0; x < 8; x++)
+                if(small.at<unsigned char>(y, x) < small.at<unsigned char>(y, x + 1)) result.hash |= uint64_t(1) << (8 * y + x);
+    }
+    // Interpolating depth would mix valid and invalid pixels, hence nearest neighbour
+    if(!depthMetric.empty()) cv::resize(depthMetric, result.depth, thumbnailSize, 0, 0, cv::INTER_NEAREST);
+    return result;
+}
+
+inline FrameChange compareFrameSignatures(const FrameSignature& a, const FrameSignature& b){
+    FrameChange result;
+    if(!a.grey.empty() && !b.grey.empty()){
+        result.grey = cv::norm(a.grey, b.grey, cv::NORM_L1) / a.grey.total();
+        result.hashDistance = __builtin_popcountll(a.hash ^ b.hash);
+    }
+    if(!a.depth.empty() && !b.depth.empty()){
+        cv::Mat valid = (a.depth > 0) & (b.depth > 0);
+        const int numValid = cv::countNonZero(valid);
+        if(numValid) result.depth = cv::norm(a.depth, b.depth, cv::NORM_L1, valid) / numValid;
+    }
+    return result;
+}
+
+inline void comparePoses(const Pose& a, const Pose& b, FrameChange& change){
+    change.translation = (a.t - b.t).norm();
+    change.rotation = a.q.angularDistance(b.q) * 180.0 / M_PI;
+}
+
+/**
+ * @brief Thresholds of FrameSelector. A frame is kept, if any of the values exceeds its threshold.
+ */
+struct FrameChangeThresholds {
+    double grey = 2.0;
+    double depth = 0.01;
+    double translation = 0.01;
+    double rotation = 1.0;
+    size_t maxSkip = 0; // Keep at least every (maxSkip+1)-th frame, 0 disables this
+};
+
+/**
+ * @brief Sequentially select frames. Frames are compared to the last kept frame, not the previous frame, so that slow
+ * motion is not lost.
+ */
+class FrameSelector {
+public:
+    FrameSelector(const FrameChangeThresholds& thresholds) : thresholds(thresholds) {}
+
+    /**
+     * @param pose Camera pose of the frame, or nullptr
+     * @param change If not nullptr, receives the difference to the last kept frame
+     * @return True, if the frame is kept
+     */
+    bool add(const FrameSignature& signature, const Pose* pose = nullptr, FrameChange* change = nullptr){
+        FrameChange c;
+        bool keep = !hasKept;
+        if(hasKept){
+            c = compareFrameSignatures(lastKept, signature);
+            if(pose && hasPose) comparePoses(lastPose, *pose, c);
+            keep = c.grey > thresholds.grey || c.depth > thresholds.depth ||
+                   c.translation > thresholds.translation || c.rotation > thresholds.rotation ||
+                   (thresholds.maxSkip && numSkipped >= thresholds.maxSkip);
+        }
+        if(change) *change = c;
+        if(keep){
+            lastKept = signature;
+            hasKept = true;
+            hasPose = pose != nullptr;
+            if(pose) lastPose = *pose;
+            numSkipped = 0;
+        } else {
+            numSkipped++;
+        }
+        return keep;
+    }
+
+private:
+    FrameChangeThresholds thresholds;
+    FrameSignature lastKept;
+    Pose lastPose = Pose(Eigen::Vector3d::Zero(), Eigen::Quaterniond::Identity());
+    bool hasKept = false;
+    bool hasPose = false;
+    size_t numSkipped = 0;
+};
+
+/**
+ * @brief Select keyframes by camera motion alone, which requires neither colour nor depth to be decoded. Frames without
+ * a valid pose (non-finite values, as used by scannet) are never kept and do not count towards maxSkip.
+ */
+inline std::vector<size_t> selectKeyframes(const std::vector<Pose>& poses, const FrameChangeThresholds& thresholds){
+    FrameSelector selector(thresholds);
+    const FrameSignature noSignature;
+    std::vector<size_t> result;
+    for(size_t i = 0; i < poses.size(); i++){
+        if(!poses[i].t.allFinite() || !poses[i].q.coeffs().allFinite()) continue;
+        if(selector.add(noSignature, &poses[i])) result.push_back(i);
+    }
+    return result;
+}
+
+/**
+ * @brief Read a list of frame indices (one per line, '#' starts a comment), as written by frame_filter
+ */
+inline std::vector<size_t> readFrameList(const std::string& path){
+    std::vector<size_t> result;
+    for(const std::string& line : readFileLines(path, true)){
+        if(line[0] == '#') continue;
+        result.push_back(std::stoul(line));
+    }
+    return result;
+}
+
+inline void writeFrameList(const std::string& path, const std::vector<size_t>& frames){
+    std::ofstream file(path);
+    if(!file.is_open()) throw std::invalid_argument("Could not open output file: " + path);
+    for(size_t f : frames) file << f << "\n";
+}
@@ -0,0 +1,197 @@
+/******************************************************************
+This file is part of https://github.com/martinruenz/dataset-tools
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>
+*****************************************************************/
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+inline unsigned defaultThreadCount(){
+    unsigned n = std::thread::hardware_concurrency();
+    return n > 0 ? n : 1;
+}
+
+/**
+ * @brief Blocking, bounded multi-producer multi-consumer queue.
+ * push() blocks while the queue is full and pop() blocks while it is empty. After close(), remaining items can still
+ * be popped, push() fails and pop() returns false as soon as the queue is drained.
+ */
+template<typename T>
+class BoundedQueue {
+public:
+    BoundedQueue(size_t capacity) : capacity(capacity > 0 ? capacity : 1) {}
+
+    bool push(T item){
+        std::unique_lock<std::mutex> lock(mutex);
+        notFull.wait(lock, [&]{ return closed || items.size() < capacity; });
+        if(closed) return false;
+        items.push_back(std::move(item));
+        notEmpty.notify_one();
+        return true;
+    }
+
+    bool pop(T& item){
+        std::unique_lock<std::mutex> lock(mutex);
+        notEmpty.wait(lock, [&]{ return closed || !items.empty(); });
+        if(items.empty()) return false;
+        item = std::move(items.front());
+        items.pop_front();
+        notFull.notify_one();
+        return true;
+    }
+
+    void close(){
+        std::lock_guard<std::mutex> lock(mutex);
+        closed = true;
+        notFull.notify_all();
+        notEmpty.notify_all();
+    }
+
+private:
+    const size_t capacity;
+    bool closed = false;
+    std::deque<T> items;
+    std::mutex mutex;
+    std::condition_variable notFull;
+    std::condition_variable notEmpty;
+};
+
+/**
+ * @brief Restores the sequential order of results that are completed out-of-order.
+ * Items are identified by consecutive sequence numbers, starting at 0. Not thread-safe, push() is supposed to be
+ * called by a single consumer.
+ */
+template<typename T>
+class ReorderBuffer {
+public:
+    /**
+     * @brief Store an item and call 'emit' for every item that is now in order (including previously stored ones).
+     */
+    template<typename F>
+    void push(size_t sequence, T item, F emit){
+        pending.emplace(sequence, std::move(item));
+        for(auto it = pending.begin(); it != pending.end() && it->first == next; it = pending.begin()){
+            emit(it->second);
+            pending.erase(it);
+            next++;
+        }
+    }
+
+    size_t numPending() const { return pending.size(); }
+    size_t numEmitted() const { return next; }
+
+private:
+    std::map<size_t, T> pending;
+    size_t next = 0;
+};
+
+/**
+ * @brief Bounds the number of items between dispatch and their in-order emission by a ReorderBuffer.
+ * Without it, a single slow item lets all subsequent items pile up in the ReorderBuffer, regardless of the capacity of
+ * the queues. The dispatcher calls acquire() before dispatching an item, the consumer calls release() for every item
+ * that was emitted. close() wakes up a blocked dispatcher, e.g. on errors.
+ */
+class ReorderWindow {
+public:
+    ReorderWindow(size_t size) : size(size > 0 ? size : 1) {}
+
+    /// Blocks while 'size' items are in flight. Returns false, if the window was closed.
+    bool acquire(){
+        std::unique_lock<std::mutex> lock(mutex);
+        notFull.wait(lock, [&]{ return closed || numDispatched - numReleased < size; });
+        if(closed) return false;
+        numDispatched++;
+        return true;
+    }
+
+    void release(){
+        std::lock_guard<std::mutex> lock(mutex);
+        numReleased++;
+        notFull.notify_one();
+    }
+
+    void close(){
+        std::lock_guard<std::mutex> lock(mutex);
+        closed = true;
+        notFull.notify_all();
+    }
+
+private:
+    const size_t size;
+    size_t numDispatched = 0;
+    size_t numReleased = 0;
+    bool closed = false;
+    std::mutex mutex;
+    std::condition_variable notFull;
+};
+
+/**
+ * @brief Keeps the first exception that was thrown by any thread of a pipeline, to re-throw it on the main thread.
+ */
+class ThreadErrors {
+public:
+    /// Run 'f' and capture any exception. Returns false, if 'f' failed.
+    template<typename F>
+    bool capture(F f){
+        try {
+            f();
+            return true;
+        } catch(...) {
+            std::lock_guard<std::mutex> lock(mutex);
+            if(!error) error = std::current_exception();
+            failed = true;
+            return false;
+        }
+    }
+
+    bool hasFailed() const { return failed; }
+
+    void rethrow(){
+        if(error) std::rethrow_exception(error);
+    }
+
+private:
+    std::mutex mutex;
+    std::exception_ptr error;
+    std::atomic<bool> failed{false};
+};
+
+/**
+ * @brief Call f(i) for all i in [0, n) on a pool of threads, in no particular order. After the first exception, no
+ * further calls are started and the exception is re-thrown.
+ */
+template<typename F>
+void parallelFor(size_t n, size_t numThreads, F f){
+    ThreadErrors errors;
+    std::atomic<size_t> next(0);
+    std::vector<std::thread> threads;
+    for(size_t t = 0; t < numThreads && t < n; t++){
+        threads.emplace_back([&](){
+            errors.capture([&](){
+                for(size_t i = next++; i < n && !errors.hasFailed(); i = next++) f(i);
+            });
+        });
+    }
+    for(std::thread& t : threads) t.join();
+    errors.rethrow();
+}
@@ -18,6 +18,7 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>
 #include "../common/common.h"
 #include "../common/common_random.h"
 #include "../common/common_3d.h"
+#include "../common/common_depth.h"
 
 using namespace std;
 using namespace cv;
@@ -75,63 +76,6 @@ Mat convertDisparityToZ(Mat input){
     return result;
 }
 
-// See: 'A Benchmark for RGB-D Visual Odometry, 3D Reconstruction and SLAM'
-//  or: 'Intrinsic Scene Properties from a Single RGB-D Image Supplementary Material'
-// The depth factor should scale depth values to meters (for instance 0.001 if depth is in mm)
-// Another approach can be found here: https://github.com/shurans/SUNCGtoolbox/blob/master/gaps/pkgs/R2Shapes/R2Grid.cpp ("AddNoise")
-Mat addNoise(Mat input, const PinholeParameters& intrinsics, bool withNormalShift, float depthFactor = 1, float discr = 35130.0) {
-
-    if(input.type() != CV_32FC1) {
-        cerr << "Error, wrong image format in addNoise()." << endl;
-        return Mat();
-    }
-
-    const float sigma_s = 0.4f; //0.5f;
-    const float sigma_d = 1.0f / 5.0f; //1.0f / 6.0f;
-    GaussianNoise noiseGeneratorD(0,sigma_d);
-    GaussianNoise noiseGeneratorS(0,sigma_s);
-
-    Mat depthCM;
-    input.convertTo(depthCM, CV_32FC1, 100 * depthFactor); // convert to cm
-
-    Projected3DCloud cloud;
-    if(withNormalShift) cloud.fromMat(depthCM, Mat(), intrinsics);
-
-    auto Z = [&](int x, int y) -> float {
-        return depthCM.at<float>(clamp(y+(int)noiseGeneratorS.generate(),0,depthCM.rows-1),
-                                     clamp(x+(int)noiseGeneratorS.generate(),0,depthCM.cols-1));
-    };
-
-    Mat result(depthCM.rows, depthCM.cols, CV_32FC1);
-    for (int i = 0; i < depthCM.rows; ++i){
-        float* pOut = result.ptr<float>(i);
-        for (int j = 0; j < depthCM.cols; ++j){
-
-            pOut[j] = discr / round(discr / Z(j,i) + noiseGeneratorD.generate() + 0.5);
-
-            if(withNormalShift){
-                Point3D& point = cloud.at(j,i);
-                Eigen::Vector3d v = point.p.normalized();
-                float angle = acos(fabs(v.dot(point.n)));
-
-                GaussianNoise noiseGeneratorN(0, 0.3 * angle/(pOut[j]+0.1));
-                float n = noiseGeneratorN.generate();
-
-                if(angle < 0.46*M_PI) pOut[j] += n;
-                else if(randomCoin((angle-M_PI_4) / M_PI_4)) pOut[j] = 0;
-            }
-        }
-    }
-
-    result.convertTo(result, CV_32FC1, 0.01 * depthFactor);
-
-    // One way to visualise (or simply run CoFusion):
-    // Projected3DCloud plyCloudTest(result, Mat(), intrinsics, 0, 100);
-    // plyCloudTest.toPly("/path/test.ply");
-
-    return result;
-}
-
 int main(int argc, char * argv[])
 {
     Parser parser(argc, argv);
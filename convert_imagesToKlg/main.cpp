@@ -16,40 +16,68 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>
 *****************************************************************/
 
 /**
- * See: https://github.com/mp3guy/Logger2/blob/master/src/Logger2.h
+ * See ../common/common_klg.h for a description of the KLG format.
  *
- * Format is:
- * int32_t at file beginning for frame count
+ * Like Logger2, compressed files contain zlib compressed depth and JPEG compressed colour. Alternatively, depth can be
+ * compressed with RVL, which decodes considerably faster (see ../common/common_rvl.h).
  *
- * For each frame:
- * int64_t: timestamp
- * int32_t: depthSize
- * int32_t: imageSize
- * depthSize * unsigned char: depth_compress_buf
- * imageSize * unsigned char: encodedImage->data.ptr
+ * With --v2, a footer with metadata, a frame index, CRCs and optional extra streams (ID masks, poses) is appended.
  */
 
 #include "../common/common.h"
+#include "../common/common_association.h"
+#include "../common/common_klg.h"
+#include "../common/common_signature.h"
+#include "../common/common_threading.h"
+#include <array>
 #include <fstream>
+#include <sstream>
 
 using namespace std;
 using namespace cv;
 
+struct EncodedFrame {
+    size_t index;
+    int64_t timestamp;
+    Mat depth; // Raw data, iff not compressed
+    Mat rgb;   // Raw data, iff not compressed
+    std::vector<unsigned char> depthCompressed;
+    std::vector<unsigned char> rgbCompressed;
+    std::vector<unsigned char> mask; // Encoded mask file, iff v2 with masks
+};
+
 int main(int argc, char * argv[])
 {
     Parser parser(argc, argv);
 
+    // Frames are either given by two directories (matched by file index), or by timestamps (associated)
+    const bool associate = parser.hasOption("--associations") || (parser.hasOption("--rgblist") && parser.hasOption("--depthlist"));
+
     if(!parser.hasOption("--out") ||
-       !parser.hasOption("--depthdir") ||
-       !parser.hasOption("--rgbdir")){
+       (!associate && !parser.hasOption("--depthdir")) ||
+       (!associate && !parser.hasOption("--rgbdir"))){
       cout << "Error, invalid arguments.\n"
-              "Mandatory --depthdir: Path to directory containing containing depth images.\n"
-              "Mandatory --rgbdir: Path to directory containing rgb images.\n"
+              "Mandatory --depthdir: Path to directory containing containing depth images (unless frames are associated).\n"
+              "Mandatory --rgbdir: Path to directory containing rgb images (unless frames are associated).\n"
               "Mandatory --out: Output klg path.\n"
+              "Optional --associations: TUM association file (ts_rgb rgb_path ts_depth depth_path), paths are relative to the file.\n"
+              "Optional --rgblist, --depthlist: TUM lists (rgb.txt, depth.txt) of unsynchronised frames, which are associated by timestamp.\n"
+              "Optional --offset: Time offset added to depth timestamps when associating (default: 0.0).\n"
+              "Optional --max_difference: Maximally allowed time difference when associating (default: 0.02).\n"
+              "Optional --write_associations: Store the associations of --rgblist and --depthlist in this file.\n"
               "Optional --fps: Frames per second (default: 24.00).\n"
               "Optional --timestamps: File that provides a timestamp for each frame (one per line).\n"
-              "Optional --tss: Timestamp scaling factor.\n"
-              "Optional -s: Factor, which scales depth values to [m] (default: 1.00).\n";
+              "Optional --tss: Timestamp scaling factor (default: 1, or 1000000 for associated frames, as TUM timestamps are in seconds).\n"
+              "Optional -s: Factor, which scales depth values to [m] (default: 1.00).\n"
+              "Optional -c: Compress frames (zlib depth, JPEG colour), as done by Logger2.\n"
+              "Optional --depthcodec: Depth codec, if compressing: zlib, rvl or raw (default: zlib).\n"
+              "Optional --quality: JPEG quality, if compressing (default: 90).\n"
+              "Optional --threads: Number of threads used to load and encode frames (default: number of cores).\n"
+              "Optional --v2: Write a v2 file, with metadata, frame index and CRCs in a footer (readable by v1 readers).\n"
+              "Optional --fx, --fy, --cx, --cy: Intrinsics stored in v2 files (default: 528, 528, width/2, height/2).\n"
+              "Optional --maskdir: Path to directory containing ID masks, which are stored as 'mask' stream of v2 files (files are stored as-is).\n"
+              "Optional --poses: File with one TUM pose (ts tx ty tz qx qy qz qw) per frame, stored as 'pose' stream of v2 files.\n"
+              "Optional --keep: File listing the frames that are stored (one index per line, as written by frame_filter). Timestamps of the full sequence are kept.\n";
       return 1;
     }
 
@@ -57,12 +85,44 @@ int main(int argc, char * argv[])
     string dirDepth = parser.getDirOption("--depthdir");
 
     string inputTimestamps = parser.getOption("--timestamps");
-    double tss = parser.getDoubleOption("--tss", 1);
-    vector<string> inputRGBs = getFilenames(dirRGB, { ".jpg", ".png"});
-    vector<string> inputDepths = getFilenames(dirDepth, { ".exr", ".png"});
+    double tss = parser.getDoubleOption("--tss", associate ? 1000000 : 1);
+    vector<string> inputRGBs, inputDepths;
+    vector<string> timestamps;
+    if(parser.hasOption("--associations")){
+        const string file = parser.getOption("--associations");
+        dirRGB = dirDepth = getDirectory(file);
+        for(const string& line : readFileLines(file, true)){
+            if(line[0] == '#') continue;
+            vector<string> columns = splitString(line, ' ', false);
+            if(columns.size() < 4) throw invalid_argument("Could not parse association: " + line);
+            timestamps.push_back(columns[0]);
+            inputRGBs.push_back(columns[1]);
+            inputDepths.push_back(columns[3]);
+        }
+    } else if(associate){
+        vector<TimestampedEntry> rgbs = readTimestampList(parser.getOption("--rgblist"));
+        vector<TimestampedEntry> depths = readTimestampList(parser.getOption("--depthlist"));
+        double offset = std::stod(parser.getStringOption("--offset", "0"));
+        double maxDifference = std::stod(parser.getStringOption("--max_difference", "0.02"));
+        dirRGB = getDirectory(parser.getOption("--rgblist"));
+        dirDepth = getDirectory(parser.getOption("--depthlist"));
+
+        ofstream associationFile;
+        if(parser.hasOption("--write_associations")) associationFile.open(parser.getOption("--write_associations"));
+        for(const Association& a : associateTimestamps(rgbs, depths, offset, maxDifference)){
+            timestamps.push_back(rgbs[a.first].stamp);
+            inputRGBs.push_back(splitString(rgbs[a.first].data, ' ')[0]);
+            inputDepths.push_back(splitString(depths[a.second].data, ' ')[0]);
+            if(associationFile.is_open())
+                associationFile << rgbs[a.first].stamp << " " << rgbs[a.first].data << " " << depths[a.second].stamp << " " << depths[a.second].data << "\n";
+        }
+        cout << "Associated " << inputRGBs.size() << " of " << rgbs.size() << " rgb and " << depths.size() << " depth frames." << endl;
+    } else {
+        inputRGBs = getFilenames(dirRGB, { ".jpg", ".png"});
+        inputDepths = getFilenames(dirDepth, { ".exr", ".png"});
+    }
     string outfile = parser.getOption("--out");
     float depthScale = 1000 * parser.getFloatOption("-s", 1.0);
-    float fps = parser.getFloatOption("-fps", 24.0);
 
     if(inputRGBs.size() == 0 || inputRGBs.size() != inputDepths.size()) {
       cerr << "Input empt or not matching." << endl;
@@ -74,61 +134,199 @@ int main(int argc, char * argv[])
       return 2;
     }
 
-    vector<string> timestamps;
     if(inputTimestamps != ""){
         timestamps = readFileLines(inputTimestamps, true);
         if(timestamps.size() != inputRGBs.size()) throw invalid_argument("Number of input timestamps != number of images");
     }
 
-    float progressStep = 1.0 / (inputRGBs.size()+1);
-    int32_t frameCount = inputRGBs.size();
+    bool v2 = parser.hasOption("--v2");
+    string dirMasks = parser.getDirOption("--maskdir");
+    vector<string> inputMasks;
+    if(dirMasks != ""){
+        inputMasks = getFilenames(dirMasks, { ".png", ".exr" });
+        if(inputMasks.size() != inputRGBs.size()) throw invalid_argument("Number of masks != number of images");
+    }
+    vector<std::array<double,7>> poses;
+    if(parser.hasOption("--poses")){
+        for(const string& line : readFileLines(parser.getOption("--poses"), true)){
+            if(line[0] == '#') continue;
+            std::array<double,7> pose;
+            double ts;
+            std::istringstream iss(line);
+            if(!(iss >> ts >> pose[0] >> pose[1] >> pose[2] >> pose[3] >> pose[4] >> pose[5] >> pose[6]))
+                throw invalid_argument("Could not parse pose: " + line);
+            poses.push_back(pose);
+        }
+        if(poses.size() != inputRGBs.size()) throw invalid_argument("Number of poses != number of images");
+    }
+    if(!v2 && (inputMasks.size() || poses.size())) throw invalid_argument("Masks and poses can only be stored in v2 files.");
+
+    float fps = parser.getFloatOption("-fps", 24.0);
     int64_t timeStep = 1000000 / fps;
-    int64_t timestamp = 0;
-    std::ofstream outStream(outfile, std::ofstream::binary);
+    if(parser.hasOption("--keep")){
+        // Timestamps are fixed before dropping frames, so that skipped frames leave gaps
+        if(timestamps.empty()){
+            for(size_t i = 0; i < inputRGBs.size(); i++) timestamps.push_back(std::to_string((i+1) * timeStep));
+            tss = 1;
+        }
+        const size_t numInputs = inputRGBs.size();
+        size_t numKept = 0, previous = 0;
+        for(size_t f : readFrameList(parser.getOption("--keep"))){
+            if(f >= numInputs) throw invalid_argument("Kept frame " + std::to_string(f) + " does not exist.");
+            // Frames are compacted in place, which requires increasing indices
+            if(numKept && f <= previous) throw invalid_argument("Kept frames have to be listed in increasing order.");
+            previous = f;
+            inputRGBs[numKept] = inputRGBs[f];
+            inputDepths[numKept] = inputDepths[f];
+            timestamps[numKept] = timestamps[f];
+            if(inputMasks.size()) inputMasks[numKept] = inputMasks[f];
+            if(poses.size()) poses[numKept] = poses[f];
+            numKept++;
+        }
+        if(numKept == 0) throw invalid_argument("No frames are kept.");
+        inputRGBs.resize(numKept);
+        inputDepths.resize(numKept);
+        timestamps.resize(numKept);
+        if(inputMasks.size()) inputMasks.resize(numKept);
+        if(poses.size()) poses.resize(numKept);
+        cout << "Keeping " << numKept << " of " << numInputs << " frames." << endl;
+    }
+
+    KlgMetadata metadata;
+    if(v2){
+        // The resolution is taken from the first frame, all frames are checked to be of the same size
+        cv::Mat first = imread(dirRGB + inputRGBs[0]);
+        if(first.total() == 0) throw std::invalid_argument("Could not read rgb-image file: " + dirRGB + inputRGBs[0]);
+        metadata.width = first.cols;
+        metadata.height = first.rows;
+        metadata.fx = parser.getFloatOption("--fx", 528);
+        metadata.fy = parser.getFloatOption("--fy", 528);
+        metadata.cx = parser.getFloatOption("--cx", 0.5 * first.cols);
+        metadata.cy = parser.getFloatOption("--cy", 0.5 * first.rows);
+        metadata.depthScale = 0.001; // Depth is stored in mm, see depthScale
+    }
 
-    outStream.write((char*)&frameCount, sizeof(frameCount));
+    bool compress = parser.hasOption("-c");
+    int jpegQuality = parser.getIntOption("--quality", 90);
+    KlgDepthCodec depthCodec = parseKlgDepthCodec(parser.getStringOption("--depthcodec", "zlib"));
+    const size_t numThreads = std::max(1, parser.getIntOption("--threads", defaultThreadCount()));
 
-    for(size_t i = 0; i < inputRGBs.size(); i++) {
+    // Set up the output before any thread is started, a failure can then simply throw
+    KlgWriter writer(outfile);
+    if(v2){
+        vector<string> streams;
+        if(inputMasks.size()) streams.push_back("mask");
+        if(poses.size()) streams.push_back("pose");
+        writer.enableFooter(metadata, streams);
+    }
 
-        showProgress(i*progressStep);
+    // Frames are loaded and encoded by a pool of workers and written in order by the main thread, which the reader
+    // never runs more than 'window' frames ahead of
+    BoundedQueue<size_t> tasks(2 * numThreads);
+    BoundedQueue<EncodedFrame> encoded(2 * numThreads);
+    ReorderWindow window(4 * numThreads);
+    ThreadErrors errors;
+    std::atomic<size_t> activeWorkers(numThreads);
+    std::vector<std::thread> threads;
 
-        const string& pathRGB = dirRGB + inputRGBs[i];
-        const string& pathDepth = dirDepth + inputDepths[i];
+    threads.emplace_back([&](){
+        for(size_t i = 0; i < inputRGBs.size() && !errors.hasFailed(); i++)
+            if(!window.acquire() || !tasks.push(i)) break;
+        tasks.close();
+    });
 
-        if(getFileIndex(pathRGB) != getFileIndex(pathDepth))
-          throw std::invalid_argument("RGB and Depth indexes are not matching.");
+    for(size_t t = 0; t < numThreads; t++){
+        threads.emplace_back([&](){
+            if(!errors.capture([&](){
+                size_t i;
+                while(tasks.pop(i)){
+                    const string& pathRGB = dirRGB + inputRGBs[i];
+                    const string& pathDepth = dirDepth + inputDepths[i];
 
-        // Load input
-        cv::Mat rgb = imread(pathRGB);
-        cv::cvtColor(rgb, rgb, cv::COLOR_RGB2BGR);
-        cv::Mat depth = imread(pathDepth, cv::IMREAD_UNCHANGED);
+                    if(!associate && getFileIndex(pathRGB) != getFileIndex(pathDepth))
+                      throw std::invalid_argument("RGB and Depth indexes are not matching.");
 
-        if(rgb.total() == 0) throw std::invalid_argument("Could not read rgb-image file: " + pathRGB);
-        if(depth.total() == 0) throw std::invalid_argument("Could not read depth-image file: " + pathDepth);
-        if(rgb.total() != depth.total()) throw std::invalid_argument("Image sizes are not matching.");
-        if(!rgb.isContinuous() || !depth.isContinuous()) throw std::invalid_argument("Data has to be continuous.");
+                    // Load input
+                    cv::Mat rgb = imread(pathRGB);
+                    cv::Mat depth = imread(pathDepth, cv::IMREAD_UNCHANGED);
 
-        if(depthScale != 1 || depth.type() != CV_16UC1) depth.convertTo(depth, CV_16UC1, depthScale);
+                    if(rgb.total() == 0) throw std::invalid_argument("Could not read rgb-image file: " + pathRGB);
+                    if(depth.total() == 0) throw std::invalid_argument("Could not read depth-image file: " + pathDepth);
+                    if(rgb.total() != depth.total()) throw std::invalid_argument("Image sizes are not matching.");
+                    if(v2 && (rgb.cols != metadata.width || rgb.rows != metadata.height))
+                        throw std::invalid_argument("All images of a v2 file need to be of the same size.");
+                    if(!rgb.isContinuous() || !depth.isContinuous()) throw std::invalid_argument("Data has to be continuous.");
 
-        if(timestamps.size()){
-            timestamp = std::stod(timestamps[i]) * tss;
-        } else {
-            timestamp += timeStep;
-        }
+                    cv::cvtColor(rgb, rgb, cv::COLOR_RGB2BGR);
+                    if(depthScale != 1 || depth.type() != CV_16UC1) depth.convertTo(depth, CV_16UC1, depthScale);
+
+                    EncodedFrame frame;
+                    frame.index = i;
+                    if(timestamps.size()){
+                        frame.timestamp = std::stod(timestamps[i]) * tss;
+                    } else {
+                        frame.timestamp = (i+1) * timeStep;
+                    }
 
-        // Write frame header
-        int32_t depthSize = depth.total() * depth.elemSize();
-        int32_t rgbSize = rgb.total() * rgb.elemSize();
-        outStream.write((char*)&timestamp, sizeof(timestamp));
-        outStream.write((char*)&depthSize, sizeof(depthSize));
-        outStream.write((char*)&rgbSize, sizeof(rgbSize));
+                    if(compress){
+                        compressKlgDepth(depth, frame.depthCompressed, depthCodec);
+                        // Like Logger2, encode the RGB-ordered data as if it was BGR
+                        cv::imencode(".jpg", rgb, frame.rgbCompressed, { cv::IMWRITE_JPEG_QUALITY, jpegQuality });
+                    } else {
+                        frame.depth = depth;
+                        frame.rgb = rgb;
+                    }
+                    if(inputMasks.size()){
+                        const string pathMask = dirMasks + inputMasks[i];
+                        if(!associate && getFileIndex(pathMask) != getFileIndex(pathRGB))
+                            throw std::invalid_argument("RGB and mask indexes are not matching.");
+                        frame.mask = readFileBytes(pathMask);
+                    }
 
-        // Write frame data
-        outStream.write((char*)depth.data, depthSize);
-        outStream.write((char*)rgb.data, rgbSize);
+                    if(!encoded.push(std::move(frame))) break;
+                }
+            })) {
+                tasks.close();
+                encoded.close();
+                window.close();
+            }
+            if(--activeWorkers == 0) encoded.close();
+        });
+    }
+
+    Progress progress(inputRGBs.size());
+    ReorderBuffer<EncodedFrame> reorder;
+    if(!errors.capture([&](){
+        EncodedFrame frame;
+        while(encoded.pop(frame)){
+            size_t index = frame.index;
+            reorder.push(index, std::move(frame), [&](const EncodedFrame& f){
+                vector<KlgStreamData> streams;
+                if(inputMasks.size()) streams.push_back({ f.mask.data(), uint32_t(f.mask.size()) });
+                if(poses.size()) streams.push_back({ poses[f.index].data(), sizeof(poses[f.index]) });
+                if(compress){
+                    writer.writeFrame(f.timestamp,
+                                      f.depthCompressed.data(), f.depthCompressed.size(),
+                                      f.rgbCompressed.data(), f.rgbCompressed.size(), streams);
+                } else {
+                    writer.writeFrame(f.timestamp,
+                                      f.depth.data, f.depth.total() * f.depth.elemSize(),
+                                      f.rgb.data, f.rgb.total() * f.rgb.elemSize(), streams);
+                }
+                progress.show();
+                window.release();
+            });
+        }
+    })) {
+        tasks.close();
+        encoded.close();
+        window.close();
     }
 
-    outStream.close();
+    for(std::thread& t : threads) t.join();
+    errors.rethrow();
+    writer.close();
+    cout << endl;
 
     return 0;
 }
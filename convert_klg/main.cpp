@@ -16,36 +16,147 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>
 *****************************************************************/
 
 /**
- * KLG-files start with a:
- * int32_t: frame count
- *
- * Afterwards, for each frame:
- * int64_t: timestamp (typically in microseconds)
- * int32_t: depthSize
- * int32_t: imageSize
- * depthSize * unsigned char: depth_compress_buf (typically 16bit per pixel, typically in mm)
- * imageSize * unsigned char: encodedImage->data.ptr
- *
- * See: https://github.com/mp3guy/Logger2/blob/master/src/Logger2.h
+ * See ../common/common_klg.h for a description of the KLG format.
  */
 
 #include "../common/common.h"
 #include "../common/common_3d.h"
-#include "JPEGLoader.h"
+#include "../common/common_klg.h"
+#include "../common/common_signature.h"
+#include "../common/common_threading.h"
+#include "../common/JPEGLoader.h"
+#include <array>
+#include <chrono>
+#include <functional>
+#include <iomanip>
 #include <zlib.h>
 
 using namespace std;
 using namespace cv;
 
+// Work item of the reader stage
+struct FrameTask {
+    size_t sequence;
+    int frame;
+};
+
+// Work item of the decode and write stages, as well as the final, ordered output
+struct DecodedFrame {
+    size_t sequence;
+    int frame;
+    int64_t timestamp;
+    Mat depth;
+    Mat depthMetric;
+    Mat rgb;
+    bool copyRgb = false; // Write the stored JPEG payload, instead of encoding 'rgb'
+    std::string tumTimestamp;
+    std::string depthName;
+    std::string rgbName;
+};
+
+/**
+ * @brief Measure the colour decoding throughput of the selected frames, with different decoding strategies.
+ * The reference mimics the former loader: a new decompressor per frame, followed by a channel swap with cvtColor.
+ */
+void benchmarkColourDecoding(KlgReader& klg, const std::vector<int>& selectedFrames, unsigned width, unsigned height){
+    std::vector<int> frames;
+    for(int f : selectedFrames)
+        if(klg.frameInfo(f).imageSize > 0 && !klg.isImageRaw(f, width, height)) frames.push_back(f);
+    if(frames.empty()){
+        cout << "No JPEG compressed colour frames selected, nothing to benchmark." << endl;
+        return;
+    }
+
+    auto measure = [&](const string& name, std::function<void(int)> decodeFrame){
+        auto t0 = std::chrono::steady_clock::now();
+        for(int f : frames) decodeFrame(f);
+        double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0).count();
+        cout << std::left << std::setw(36) << name << std::fixed << std::setprecision(3) << ms / frames.size() << " ms/frame" << endl;
+    };
+
+    cout << "Decoding " << frames.size() << " colour frames per run..." << endl;
+    Mat buffer, rgb;
+    for(int f : frames) klg.prefetch(f);
+
+    measure("reference (per-frame loader+cvtColor)", [&](int f){
+        JPEGLoader jpeg;
+        buffer.create(height, width, CV_8UC3);
+        jpeg.readData((unsigned char*)klg.imageData(f), klg.frameInfo(f).imageSize, buffer.data, width, height);
+        cvtColor(buffer, rgb, cv::COLOR_BGR2RGB);
+    });
+
+    JPEGLoader jpeg;
+    measure("persistent loader, direct order", [&](int f){
+        rgb.create(height, width, CV_8UC3);
+        jpeg.decode(klg.imageData(f), klg.frameInfo(f).imageSize, rgb.data, width, height, false);
+    });
+
+    for(int scale : {2, 4, 8}){
+        measure("persistent loader, 1/" + std::to_string(scale) + " resolution", [&](int f){
+            int w, h;
+            jpeg.readSize(klg.imageData(f), klg.frameInfo(f).imageSize, w, h, scale);
+            rgb.create(h, w, CV_8UC3);
+            jpeg.decode(klg.imageData(f), klg.frameInfo(f).imageSize, rgb.data, w, h, false, rgb.step, scale);
+        });
+    }
+}
+
+/**
+ * @brief Compare the depth codecs on the selected frames, in terms of compression ratio and throughput.
+ * Throughput is stated in MB of uncompressed depth per second.
+ */
+void benchmarkDepthCodecs(KlgReader& klg, const std::vector<int>& selectedFrames, unsigned width, unsigned height){
+    std::vector<Mat> depths;
+    Mat buffer;
+    for(int f : selectedFrames){
+        if(klg.frameInfo(f).depthSize == 0) continue;
+        depths.push_back(klg.readDepth(f, width, height, buffer).clone());
+    }
+    if(depths.empty()){
+        cout << "No depth frames selected, nothing to benchmark." << endl;
+        return;
+    }
+    const double rawMB = depths.size() * width * height * 2 / (1024.0 * 1024.0);
+
+    cout << "Encoding and decoding " << depths.size() << " depth frames per codec..." << endl;
+    for(KlgDepthCodec codec : {KlgDepthCodec::Zlib, KlgDepthCodec::Rvl}){
+        std::vector<std::vector<unsigned char>> encoded(depths.size());
+        auto t0 = std::chrono::steady_clock::now();
+        for(size_t i = 0; i < depths.size(); i++) compressKlgDepth(depths[i], encoded[i], codec);
+        auto t1 = std::chrono::steady_clock::now();
+        for(size_t i = 0; i < depths.size(); i++){
+            buffer.create(height, width, CV_16UC1);
+            if(codec == KlgDepthCodec::Rvl){
+                decompressRvlDepth(encoded[i].data(), encoded[i].size(), buffer.ptr<uint16_t>(), buffer.total());
+            } else {
+                uLongf decompLength = width * height * 2;
+                if(uncompress(buffer.data, &decompLength, encoded[i].data(), encoded[i].size()) != Z_OK)
+                    throw std::runtime_error("Could not decompress depth.");
+            }
+        }
+        auto t2 = std::chrono::steady_clock::now();
+
+        size_t encodedBytes = 0;
+        for(const auto& e : encoded) encodedBytes += e.size();
+        const double encodeSeconds = std::chrono::duration<double>(t1 - t0).count();
+        const double decodeSeconds = std::chrono::duration<double>(t2 - t1).count();
+        cout << std::left << std::setw(6) << (codec == KlgDepthCodec::Rvl ? "rvl" : "zlib") << std::fixed << std::setprecision(2)
+             << " ratio: " << std::setw(7) << rawMB * 1024 * 1024 / encodedBytes
+             << " encode: " << std::setw(9) << rawMB / encodeSeconds << "MB/s"
+             << " decode: " << std::setw(9) << rawMB / decodeSeconds << "MB/s" << endl;
+    }
+}
+
 int main(int argc, char * argv[])
 {
     //return 0; // outsourced computations, test if it is still working.
     Parser parser(argc, argv);
     //printf("Running with OpenCV: %s", cv::getBuildInformation().c_str());
 
+    const bool benchmark = parser.hasOption("-benchmark");
     if(!parser.hasOption("-i")
-            || !parser.hasOption("-o")
-            || (!parser.hasOption("-plys") && !parser.hasOption("-frames"))
+            || (!benchmark && !parser.hasOption("-o"))
+            || (!benchmark && !parser.hasOption("-clouds") && !parser.hasOption("-frames"))
             || (parser.hasOption("-tum") && parser.hasOption("-sub"))){
         cout << "Error, invalid arguments.\n"
                 "Mandatory -i: Input klg file.\n"
@@ -54,14 +165,27 @@ int main(int argc, char * argv[])
                 "Optional -clouds: Extract a ply pointcloud per frame, this or -frames is required.\n"
                 "Optional -m: Min depth in mm (default value: 2).\n"
                 "Optional -s: Silent. Don't show frames during export.\n"
-                "Optional -w: Image width (default value: 640).\n"
-                "Optional -h: Image height (default value: 480).\n"
-                "Optional -cx: Optical center x (default value: 320).\n"
-                "Optional -cy: Optical center y (default value: 240).\n"
-                "Optional -fx: Focal length x (default value: 528).\n"
-                "Optional -fy: Focal length y (default value: 528).\n"
+                "Optional -w: Image width (default value: 640, or as stored in v2 files).\n"
+                "Optional -h: Image height (default value: 480, or as stored in v2 files).\n"
+                "Optional -cx: Optical center x (default value: 320, or as stored in v2 files).\n"
+                "Optional -cy: Optical center y (default value: 240, or as stored in v2 files).\n"
+                "Optional -fx: Focal length x (default value: 528, or as stored in v2 files).\n"
+                "Optional -fy: Focal length y (default value: 528, or as stored in v2 files).\n"
                 "Optional -f: Numer of frame (only this frame is processed).\n"
+                "Optional -start: First frame that is processed (default value: 0).\n"
+                "Optional -end: Last frame that is processed (default value: last frame of file).\n"
+                "Optional -step: Only process every n-th frame (default value: 1).\n"
+                "Optional -keep: File listing the frames that are processed (one index per line, as written by frame_filter).\n"
+                "Optional -keyframes: Only process keyframes of the selected frames, which are chosen by camera motion ('pose' stream of v2 files).\n"
+                "Optional -translation: Keyframes, minimum camera translation since the last keyframe [m] (default value: 0.05).\n"
+                "Optional -rotation: Keyframes, minimum camera rotation since the last keyframe [deg] (default value: 5).\n"
+                "Optional -maxskip: Keyframes, never skip more than this number of consecutive frames (default value: 0, unlimited).\n"
+                "Optional -noindex: Neither read nor write the frame index file (<input>.idx).\n"
+                "Optional -threads: Number of worker threads used for decoding and writing (default value: number of cores).\n"
+                "Optional -benchmark: Only measure colour decoding and depth codec (zlib, rvl) speed on the selected frames, nothing is exported (-o is not required).\n"
                 "Optional -png: Export PNG instead of JPG.\n"
+                "Optional -copyjpg: Write JPEG colour payloads as stored, without decoding and re-encoding them (much faster and lossless).\n"
+                "   Note that Logger2 and convert_imagesToKlg store colour with swapped red and blue channels, which is kept by this option.\n"
                 "Optional -tum: Export in TUM format, when exporting frames ('-frames'). Incompatible to '-sub'.\n"
                 "Optional -sub: Export depth and rgb frames to different folders ('depth', 'color'), when exporting frames ('-frames'). Incompatible to '-tum'.\n"
                 "Optional -depthpng: Export depth images as 16-bit greyscale PNG instead of float exr.\n"
@@ -83,7 +207,7 @@ int main(int argc, char * argv[])
         return 1;
     }
 
-    if(!exists(outputDir)){
+    if(!benchmark && !exists(outputDir)){
         if(parser.askYesNo("Output directory does not exist. Create?")){
             createDirectory(outputDir);
         } else {
@@ -101,7 +225,6 @@ int main(int argc, char * argv[])
     float depthscale = parser.getFloatOption("-depthscale", 5);
     unsigned width = 640;
     unsigned height = 480;
-    const int numPixel = width*height;
     //bool alsoImages = parser.hasOption("-a");
     //bool noPointCloud = parser.hasOption("-n");
     bool extract_images = parser.hasOption("-frames");
@@ -112,6 +235,9 @@ int main(int argc, char * argv[])
     bool subdirs = parser.hasOption("-sub");
     const string depthFileExt = depthPNG ? ".png" : ".exr";
     const string colorFileExt = parser.hasOption("-png") ? ".png" : ".jpg";
+    // Colour pixels are only needed for the display, point clouds and conversions
+    const bool copyJpeg = parser.hasOption("-copyjpg") && extract_images && colorFileExt == ".jpg";
+    const bool needPixels = !copyJpeg || !silent || extract_clouds;
     if(parser.hasOption("-m")) depthmin = 0.001 * parser.getFloatOption("-m");
     if(parser.hasOption("-w")) width = parser.getIntOption("-w");
     if(parser.hasOption("-h")) height = parser.getIntOption("-h");
@@ -120,16 +246,6 @@ int main(int argc, char * argv[])
     if(parser.hasOption("-fy")) intrinsics.fy = parser.getFloatOption("-fy");
     if(parser.hasOption("-fx")) intrinsics.fx = parser.getFloatOption("-fx");
 
-    int numFrames = 0;
-    unsigned char* depthReadBuffer;
-    unsigned char* imageReadBuffer;
-    unsigned char* decompressionBufferDepth;
-    unsigned char* decompressionBufferImage;
-    int32_t depthSize = 0;
-    int32_t imageSize = 0;
-    int64_t timestamp;
-    JPEGLoader jpeg;
-
     std::ofstream fDList, fRGBList, fAssociations;
     if(tumFormat){
         fDList.open(outputDir+"/depth.txt");
@@ -145,114 +261,230 @@ int main(int argc, char * argv[])
         boost::filesystem::create_directories(outputDirRGB);
         boost::filesystem::create_directories(outputDirDepth);
     }
-    FILE* fp = fopen(inputFile.c_str(), "rb");
-    CHECK_THROW(fread(&numFrames, sizeof(int32_t), 1, fp));
-
-    depthReadBuffer = new unsigned char[numPixel * 2];
-    imageReadBuffer = new unsigned char[numPixel * 3];
-    decompressionBufferDepth = new unsigned char[numPixel * 2];
-    decompressionBufferImage = new unsigned char[numPixel * 3];
-
-    cout << "Start working on KLG file with " << numFrames << " frames..." << endl;
 
-    Progress progress(numFrames);
-    size_t numErrors = 0;
-    int currentFrame=0;
-
-    // Skip beginning of sequence
-    if(parser.hasOption("-f")){
-        int frame = parser.getIntOption("-f");
-        while(currentFrame < frame && currentFrame < numFrames) {
-            CHECK_THROW(fread(&timestamp, sizeof(int64_t), 1, fp));
-            CHECK_THROW(fread(&depthSize, sizeof(int32_t), 1, fp));
-            CHECK_THROW(fread(&imageSize, sizeof(int32_t), 1, fp));
-            CHECK_THROW(fread(depthReadBuffer, depthSize, 1, fp));
-            if(imageSize > 0) CHECK_THROW(fread(imageReadBuffer, imageSize, 1, fp));
-
-            currentFrame++;
-            progress.show();
-        }
-        numFrames = currentFrame+1;
+    KlgReader klg(inputFile, !parser.hasOption("-noindex"));
+
+    // v2 files describe themselves, options given on the command line take precedence
+    float metresPerDepthUnit = 0.001;
+    if(klg.hasFooter()){
+        const KlgMetadata& metadata = klg.getMetadata();
+        if(!parser.hasOption("-w")) width = metadata.width;
+        if(!parser.hasOption("-h")) height = metadata.height;
+        if(!parser.hasOption("-fx")) intrinsics.fx = metadata.fx;
+        if(!parser.hasOption("-fy")) intrinsics.fy = metadata.fy;
+        if(!parser.hasOption("-cx")) intrinsics.cx = metadata.cx;
+        if(!parser.hasOption("-cy")) intrinsics.cy = metadata.cy;
+        metresPerDepthUnit = metadata.depthScale;
     }
-
-    for(; currentFrame < numFrames; currentFrame++){
-
-        //cout << "Start processing frame " << currentFrame << endl;
-        stringstream ss;
-        ss << setw(4) << setfill('0') << currentFrame;
-        std::string indexStr = ss.str();
-
-        // Extract
-        CHECK_THROW(fread(&timestamp, sizeof(int64_t), 1, fp));
-        CHECK_THROW(fread(&depthSize, sizeof(int32_t), 1, fp));
-        CHECK_THROW(fread(&imageSize, sizeof(int32_t), 1, fp));
-        CHECK_THROW(fread(depthReadBuffer, depthSize, 1, fp));
-        if(imageSize > 0) CHECK_THROW(fread(imageReadBuffer, imageSize, 1, fp));
-
-        if(depthSize == numPixel * 2){
-            memcpy(&decompressionBufferDepth[0], depthReadBuffer, numPixel * 2);
-        }else{
-            unsigned long decompLength = numPixel * 2;
-            uncompress(&decompressionBufferDepth[0], (unsigned long *)&decompLength, (const Bytef *)depthReadBuffer, depthSize);
+    int numFrames = klg.numFrames();
+    if(klg.isTruncated())
+        cout << "Warning, KLG file is truncated. Only " << numFrames << " of " << klg.getHeaderFrameCount() << " frames are readable." << endl;
+
+    // Select range of frames
+    int startFrame = parser.getIntOption("-start", 0);
+    int endFrame = parser.getIntOption("-end", numFrames-1);
+    int stepFrames = parser.getIntOption("-step", 1);
+    if(parser.hasOption("-f")) startFrame = endFrame = parser.getIntOption("-f");
+    endFrame = std::min(endFrame, numFrames-1);
+    if(startFrame < 0 || stepFrames < 1) throw std::invalid_argument("Invalid frame range.");
+    std::vector<int> selectedFrames;
+    for(int f = startFrame; f <= endFrame; f += stepFrames) selectedFrames.push_back(f);
+    if(parser.hasOption("-keep")){
+        std::vector<bool> keep(numFrames, false);
+        for(size_t f : readFrameList(parser.getOption("-keep"))) if(f < keep.size()) keep[f] = true;
+        selectedFrames.erase(std::remove_if(selectedFrames.begin(), selectedFrames.end(), [&](int f){ return !keep[f]; }), selectedFrames.end());
+    }
+    if(parser.hasOption("-keyframes")){
+        // Only the pose stream is read, frames that are not selected are never decoded
+        const int poseStream = klg.findStream("pose");
+        if(poseStream < 0) throw std::invalid_argument("-keyframes requires camera poses, which are stored in the 'pose' stream of v2 files.");
+        FrameChangeThresholds thresholds;
+        thresholds.translation = parser.getDoubleOption("-translation", 0.05);
+        thresholds.rotation = parser.getDoubleOption("-rotation", 5);
+        thresholds.maxSkip = std::max(0, parser.getIntOption("-maxskip", 0));
+        std::vector<Pose> poses;
+        for(int f : selectedFrames){
+            std::array<double,7> p;
+            p.fill(std::numeric_limits<double>::quiet_NaN());
+            if(klg.streamSize(poseStream, f) == sizeof(p)) memcpy(p.data(), klg.streamData(poseStream, f), sizeof(p));
+            poses.emplace_back(Eigen::Vector3d(p[0], p[1], p[2]), Eigen::Quaterniond(p[6], p[3], p[4], p[5]));
         }
+        std::vector<int> keyframes;
+        for(size_t k : selectKeyframes(poses, thresholds)) keyframes.push_back(selectedFrames[k]);
+        selectedFrames.swap(keyframes);
+    }
+    int numSelected = selectedFrames.size();
 
-        if(imageSize == numPixel * 3) memcpy(&decompressionBufferImage[0], imageReadBuffer, numPixel * 3);
-        else if(imageSize > 0) jpeg.readData(imageReadBuffer, imageSize, (unsigned char *)&decompressionBufferImage[0]);
-        else throw std::invalid_argument("Invalid data.");
+    if(benchmark){
+        benchmarkColourDecoding(klg, selectedFrames, width, height);
+        benchmarkDepthCodecs(klg, selectedFrames, width, height);
+        return 0;
+    }
 
-        Mat depth(height, width, CV_16UC1, (unsigned short*)&decompressionBufferDepth[0]);
-        Mat rgb(height, width, CV_8UC3, (unsigned char*)&decompressionBufferImage[0]);
-        cvtColor(rgb, rgb, cv::COLOR_BGR2RGB);
+    cout << "Start working on KLG file with " << numFrames << " frames (exporting " << numSelected << ")..." << endl;
+
+    // The export runs as a pipeline: [reader] -> [decoders] -> [writers] -> [main thread: ordered lists, display]
+    const unsigned numThreads = std::max(2, parser.getIntOption("-threads", defaultThreadCount()));
+    const unsigned numDecoders = std::max(1u, numThreads / 3);
+    const unsigned numWriters = std::max(1u, numThreads - numDecoders);
+    BoundedQueue<FrameTask> tasks(2 * numThreads);
+    BoundedQueue<DecodedFrame> decoded(2 * numThreads);
+    BoundedQueue<DecodedFrame> written(2 * numThreads);
+    ReorderWindow window(8 * numThreads);
+    ThreadErrors errors;
+    std::atomic<unsigned> activeDecoders(numDecoders);
+    std::atomic<unsigned> activeWriters(numWriters);
+
+    auto closeQueues = [&](){
+        tasks.close();
+        decoded.close();
+        written.close();
+        window.close();
+    };
+
+    std::vector<std::thread> threads;
+
+    // Reader: dispatches frames in order and lets the kernel fetch their payloads ahead of time
+    threads.emplace_back([&](){
+        if(!errors.capture([&](){
+            size_t sequence = 0;
+            for(int currentFrame : selectedFrames){
+                if(!window.acquire()) break;
+                klg.prefetch(currentFrame);
+                if(!tasks.push({sequence++, currentFrame})) break;
+            }
+        })) closeQueues();
+        tasks.close();
+    });
+
+    // Decoders: inflate depth, decode jpeg colour
+    for(unsigned t = 0; t < numDecoders; t++){
+        threads.emplace_back([&](){
+            JPEGLoader jpeg;
+            if(!errors.capture([&](){
+                FrameTask task;
+                while(tasks.pop(task)){
+                    const KlgFrameInfo& frameInfo = klg.frameInfo(task.frame);
+                    DecodedFrame result;
+                    result.sequence = task.sequence;
+                    result.frame = task.frame;
+                    result.timestamp = frameInfo.timestamp;
+
+                    // Compressed depth is inflated into a new matrix per frame, as it is handed over to the writers
+                    Mat depthBuffer;
+                    result.depth = klg.readDepth(task.frame, width, height, depthBuffer);
+
+                    Mat rgbRaw = klg.imageView(task.frame, width, height);
+                    result.copyRgb = copyJpeg && rgbRaw.empty() && frameInfo.imageSize > 0;
+                    if(result.copyRgb && !needPixels){
+                        // The payload is written by the writers, directly from the mapped file
+                    } else if(!rgbRaw.empty()){
+                        // Never convert in-place, raw payloads are read-only views of the mapped file
+                        cvtColor(rgbRaw, result.rgb, cv::COLOR_BGR2RGB);
+                    } else if(frameInfo.imageSize > 0) {
+                        // Decoding without channel swap yields the same memory layout as the raw path, see common_klg.h
+                        result.rgb.create(height, width, CV_8UC3);
+                        jpeg.decode(klg.imageData(task.frame), frameInfo.imageSize, result.rgb.data, width, height, false);
+                    } else {
+                        throw std::invalid_argument("Invalid data.");
+                    }
+
+                    result.depth.convertTo(result.depthMetric, CV_32FC1, metresPerDepthUnit);
+
+                    if(!decoded.push(std::move(result))) break;
+                }
+            })) closeQueues();
+            if(--activeDecoders == 0) decoded.close();
+        });
+    }
 
-        if(!silent){
-            cv::imshow("Depth", depth);
-            cv::waitKey(1);
-            cv::imshow("RGB", rgb);
-            cv::waitKey(1);
-        }
+    // Writers: encode and store images and point clouds
+    for(unsigned t = 0; t < numWriters; t++){
+        threads.emplace_back([&](){
+            if(!errors.capture([&](){
+                DecodedFrame frame;
+                while(decoded.pop(frame)){
+                    stringstream ss;
+                    ss << setw(4) << setfill('0') << frame.frame;
+                    std::string indexStr = ss.str();
+
+                    // Optional image export
+                    if(extract_images){
+                        if(tumFormat){
+                            std::string& ts = frame.tumTimestamp;
+                            ts = to_string(frame.timestamp);//timestamp / double(1e6);
+                            ts.insert(ts.end()-6,'.');
+                            frame.depthName = ts+depthFileExt;
+                            frame.rgbName = ts+colorFileExt;
+                        } else {
+                            frame.depthName = "Depth"+indexStr+depthFileExt;
+                            frame.rgbName = "Color"+indexStr+colorFileExt;
+                        }
+                        if(frame.copyRgb)
+                            writeFileBytes(outputDirRGB + "/" + frame.rgbName, klg.imageData(frame.frame), klg.frameInfo(frame.frame).imageSize);
+                        else
+                            cv::imwrite(outputDirRGB + "/" + frame.rgbName, frame.rgb);
+                        if(depthPNG) {
+                            cv::Mat depthScaled;
+                            frame.depth.convertTo(depthScaled, CV_16UC1, depthscale);
+                            imwrite(outputDirDepth + "/" + frame.depthName, depthScaled);
+                        } else {
+                            imwrite(outputDirDepth + "/" + frame.depthName, frame.depthMetric); //storeFloatImage(depthMetric, depthPath, 0, 50);
+                        }
+                    }
+
+                    // 3D generation
+                    if(extract_clouds){
+                        Projected3DCloud points(frame.depthMetric, frame.rgb, intrinsics, depthmin);
+                        points.toPly(outputDirCloud+"/Points"+indexStr+".ply");
+                    }
+
+                    // Only keep what the main thread still needs
+                    frame.depthMetric.release();
+                    if(silent){
+                        frame.depth.release();
+                        frame.rgb.release();
+                    }
+                    if(!written.push(std::move(frame))) break;
+                }
+            })) closeQueues();
+            if(--activeWriters == 0) written.close();
+        });
+    }
 
-        cv::Mat depthMetric;
-        depth.convertTo(depthMetric, CV_32FC1, 0.001);
-
-        // Optional image export
-        if(extract_images){
-            std::string depthName, rgbName, ts;
-            if(tumFormat){
-                ts = to_string(timestamp);//timestamp / double(1e6);
-                ts.insert(ts.end()-6,'.');
-                depthName = ts+depthFileExt;
-                rgbName = ts+colorFileExt;
-                fDList << ts << " depth/" << depthName << endl;
-                fRGBList << ts << " rgb/" << rgbName << endl;
-                fAssociations << ts << " rgb/" << rgbName << " " << ts << " depth/" << depthName << endl;
-            } else {
-                depthName = "Depth"+indexStr+depthFileExt;
-                rgbName = "Color"+indexStr+colorFileExt;
-            }
-            cv::imwrite(outputDirRGB + "/" + rgbName, rgb);
-            if(depthPNG) {
-                depth *= depthscale; // weirdly, putting this in the function call leads to a segmentation fault. (seems to be an opencv bug)
-                imwrite(outputDirDepth + "/" + depthName, depth);
-            } else {
-                imwrite(outputDirDepth + "/" + depthName, depthMetric); //storeFloatImage(depthMetric, depthPath, 0, 50);
-            }
+    // Main thread: restore frame order for the file lists, the progress bar and the display. The reader never runs
+    // more than 'window' frames ahead of it.
+    Progress progress(numSelected);
+    size_t numErrors = 0;
+    ReorderBuffer<DecodedFrame> reorder;
+    if(!errors.capture([&](){
+        DecodedFrame frame;
+        while(written.pop(frame)){
+            size_t sequence = frame.sequence;
+            reorder.push(sequence, std::move(frame), [&](const DecodedFrame& f){
+                if(extract_images && tumFormat){
+                    const std::string& ts = f.tumTimestamp;
+                    fDList << ts << " depth/" << f.depthName << endl;
+                    fRGBList << ts << " rgb/" << f.rgbName << endl;
+                    fAssociations << ts << " rgb/" << f.rgbName << " " << ts << " depth/" << f.depthName << endl;
+                }
+                if(!silent){
+                    cv::imshow("Depth", f.depth);
+                    cv::waitKey(1);
+                    cv::imshow("RGB", f.rgb);
+                    cv::waitKey(1);
+                }
+                progress.show();
+                window.release();
+            });
         }
+    })) closeQueues();
 
-        // 3D generation
-        if(extract_clouds){
-            Projected3DCloud points(depthMetric, rgb, intrinsics, depthmin);
-            points.toPly(outputDirCloud+"/Points"+indexStr+".ply");
-        }
-        progress.show();
-    }
+    for(std::thread& t : threads) t.join();
+    errors.rethrow();
 
     cout << "\nDone. Errors: " << numErrors << endl;
 
-    delete[] depthReadBuffer;
-    delete[] imageReadBuffer;
-    delete[] decompressionBufferDepth;
-    delete[] decompressionBufferImage;
-    fclose(fp);
     if(tumFormat){
         fDList.close();
         fRGBList.close();
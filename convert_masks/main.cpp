@@ -17,14 +17,60 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>
 
 #include "../common/common.h"
 #include "../common/common_labels.h"
+#include "../common/common_threading.h"
+
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <iomanip>
+#include <mutex>
 
 using namespace std;
 using namespace cv;
 
+/**
+ * @brief Measure labelToColourImage on random 4K ID-images of all supported types. The reference mimics the former
+ * conversion: intToColour per pixel, on a single thread.
+ */
+void benchmarkLabelToColour(int runs){
+    const int width = 3840, height = 2160;
+    auto measure = [&](const string& name, std::function<void()> convert){
+        auto t0 = std::chrono::steady_clock::now();
+        for(int r = 0; r < runs; r++) convert();
+        double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0).count();
+        cout << std::left << std::setw(36) << name << std::fixed << std::setprecision(3) << ms / runs << " ms/frame" << endl;
+    };
+
+    cout << "Converting " << width << "x" << height << " ID-images, " << runs << " runs each..." << endl;
+    for(int type : { CV_8UC1, CV_16UC1, CV_32SC1 }){
+        const string name = type == CV_8UC1 ? "8-bit" : type == CV_16UC1 ? "16-bit" : "32-bit";
+        Mat ids(height, width, type), labels;
+        cv::randu(ids, 0, 300); // Includes the special id 255
+        ids.convertTo(labels, CV_32SC1);
+        Mat reference(height, width, CV_8UC3), result;
+
+        measure(name + ", reference", [&](){
+            for(int i = 0; i < height; i++){
+                const int* pIn = labels.ptr<int>(i);
+                cv::Vec3b* pOut = reference.ptr<cv::Vec3b>(i);
+                for(int j = 0; j < width; j++) pOut[j] = intToColour(pIn[j]);
+            }
+        });
+        measure(name + ", table, single thread", [&](){ result = labelToColourImage(ids, false); });
+        measure(name + ", table, parallel", [&](){ result = labelToColourImage(ids); });
+        if(cv::norm(reference, result, cv::NORM_INF) != 0) throw std::runtime_error("Colours of " + name + " IDs do not match the reference.");
+    }
+}
+
 int main(int argc, char * argv[])
 {
     Parser parser(argc, argv);
 
+    if(parser.hasOption("--benchmark")){
+        benchmarkLabelToColour(10);
+        return 0;
+    }
+
     if(!parser.hasOption("--dir") || !parser.hasOption("--outdir")){
         cout << "This tool converts RGB-images to ID-images, or vice-versa.\n\n";
         cout << "Error, invalid arguments.\n"
@@ -35,6 +81,10 @@ int main(int argc, char * argv[])
                 "Optional -n: Just simulate and don't write anything to disc.\n"
                 "Optional -v: Verbose.\n"
                 "Optional --toRGB: Convert to ID to RGB.\n"
+                "Optional --palette: Colour table (one 'r g b' per line, the n-th colour has ID n). If the file exists, its IDs\n"
+                "                    are kept and new colours are appended. The updated table is written back.\n"
+                "Optional --threads: Number of threads (default: number of cores).\n"
+                "Optional --benchmark: Only measure the ID to RGB conversion of 4K images, nothing else is done.\n"
                 "\n"
                 "Example: ./convert_masks --dir /path/to/input_folder --outdir /path/to/out_folder/\n"
                 "\n\n"
@@ -52,30 +102,58 @@ int main(int argc, char * argv[])
     bool verbose = parser.hasOption("-v");
     bool toRGB = parser.hasOption("--toRGB");
     bool storePNG = parser.hasOption("-p") || toRGB;
+    const size_t numThreads = std::max(1, parser.getIntOption("--threads", defaultThreadCount()));
 
-    vector<string> files = getFilenames(directory, {".png", ".ppm"});
-
-    std::vector<cv::Vec3b> colors;
-    size_t numErrors = 0;
-
-    for(auto&& file : files){
-        string path_input = directory + file;
+    vector<string> files;
+    for(auto&& file : getFilenames(directory, {".png", ".ppm"})){
         string path_output = out_directory + getBasename(file) + (storePNG ? ".png" : ".pgm");
         if(skipExisting && exists(path_output)){
             cout << "Skipping file: " << path_output << " (already exists). Warning: Completely ignored!" << endl;
             continue;
         }
-        if(verbose) cout << "\nConverting file:\n" << path_input << " to\n" << path_output << endl;
+        files.push_back(file);
+    }
+
+    // IDs depend on the order in which colours first appear in the dataset. Hence, the colours of all files are
+    // collected in parallel first and merged in file order. Then, files are converted in parallel with this table.
+    std::vector<cv::Vec3b> colors;
+    if(!toRGB){
+        if(parser.hasOption("--palette") && exists(parser.getOption("--palette")))
+            colors = readColourTable(parser.getOption("--palette"));
+        vector<vector<cv::Vec3b>> fileColors(files.size());
+        parallelFor(files.size(), numThreads, [&](size_t i){
+            Mat image = imread(directory + files[i]);
+            if(image.type() == CV_8UC3) fileColors[i] = findColourOrder(image); // Errors are reported below
+        });
+        for(const vector<cv::Vec3b>& c : fileColors) mergeColourTable(colors, c);
+        if(colors.size() > 256) cout << "Warning: More than 256 colours, IDs are not unique." << endl;
+        if(doWrite && parser.hasOption("--palette")) writeColourTable(parser.getOption("--palette"), colors);
+    }
+
+    std::atomic<size_t> numErrors(0);
+    std::mutex outputMutex;
+    Progress progress(files.size());
+    parallelFor(files.size(), numThreads, [&](size_t i){
+        const string& file = files[i];
+        string path_input = directory + file;
+        string path_output = out_directory + getBasename(file) + (storePNG ? ".png" : ".pgm");
         Mat image = imread(path_input);
         Mat image_out;
-        if(toRGB) image_out = labelToColourImage(image);
-        else image_out = colourToLabelImage(image, colors);
+        if(toRGB) image_out = labelToColourImage(image, false);
+        else {
+            std::vector<cv::Vec3b> table = colors;
+            image_out = colourToLabelImage(image, table, 0, false);
+            if(table.size() != colors.size()) throw std::runtime_error("File changed during conversion: " + path_input);
+        }
         if(image_out.total() == 0) numErrors++;
         else if(doWrite) {
             if(storePNG) imwrite(path_output, image_out);
             else imwrite(path_output, image_out, { cv::IMWRITE_PXM_BINARY });
         }
-    }
+        std::lock_guard<std::mutex> lock(outputMutex);
+        if(verbose) cout << "\nConverted file:\n" << path_input << " to\n" << path_output << endl;
+        else progress.show();
+    });
 
     cout << "\nDone. Errors: " << numErrors;
     if(!toRGB) cout << " Number of masks: " << colors.size();
@@ -16,17 +16,193 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>
 *****************************************************************/
 
 #include <cstddef>
+#include <functional>
+#include <iomanip>
 #include <iostream>
+#include <limits>
+#include <memory>
+#include <numeric>
+#include <set>
 #include "../common/common.h"
-#include "../external/scannet/sensorData.h"
+#include "../common/common_registration.h"
+#include "../common/common_sens.h"
+#include "../common/common_signature.h"
+#include "../common/common_threading.h"
 
 using namespace std;
 using namespace cv;
 
-typedef std::chrono::time_point<std::chrono::system_clock> Time;
-typedef std::chrono::duration<double> Duration;
-typedef std::chrono::system_clock Clock;
 enum class RotationFormat { Matrix, Quaternion, Exponential };
+enum class Registration { None, Depth, Color }; // Depth: depth is warped into the colour camera, Color: vice versa
+
+/// A *.sens file that is being extracted
+struct Sequence {
+    string name;
+    std::unique_ptr<SensReader> sens;
+    string framesDirectory; // Empty, if frames are not exported
+    string trajectoryFilename; // Empty, if the trajectory is not exported
+    std::vector<size_t> frames; // Frames to extract, in order. Set when the sequence is opened.
+    std::unique_ptr<DepthRegistration> registration; // Set when the sequence is opened, if frames are registered
+
+    // Only used by the main thread
+    std::ofstream trajectory;
+    ReorderBuffer<size_t> order;
+    bool reported = false;
+
+    std::atomic<bool> failed{false}; // Remaining frames are skipped
+};
+
+struct FrameTask {
+    std::shared_ptr<Sequence> sequence;
+    size_t index; // Position in Sequence::frames
+    size_t frame;
+    string error; // Set by the workers, if the frame could not be extracted
+};
+
+/// The frame's file name stem, timestamps are often not set
+uint64_t frameTimestamp(const SensFrameInfo& frame, size_t i){
+    return std::max(std::max(frame.timeStampColor, frame.timeStampDepth), uint64_t(i));
+}
+
+void writeTrajectoryLine(std::ostream& trajectory_stream, const SensFrameInfo& frame, size_t i, RotationFormat rotation_format){
+    const string sep = "\t";
+    uint64_t ts = frameTimestamp(frame, i);
+    const float* t = frame.cameraToWorld;
+    if(t[15] != 1 || t[14] != 0 || t[13] != 0 || t[12] != 0)
+        throw invalid_argument("sens file contains illegal transformation in frame ["+to_string(i)+"], last row of matrix: " +
+                               to_string(t[12]) + " " +
+                               to_string(t[13]) + " " +
+                               to_string(t[14]) + " " +
+                               to_string(t[15]));
+
+    Eigen::Matrix3f rot;
+    Eigen::Vector3f trans;
+    rot << t[0], t[1], t[2],
+            t[4], t[5], t[6],
+            t[8], t[9], t[10];
+    trans << t[3], t[7], t[11];
+
+    trajectory_stream   << ts << sep << trans(0) << sep << trans(1) << sep << trans(2) << sep;
+
+    //            if(true) {
+    //                Eigen::Matrix3f flip = Eigen::AngleAxisf(M_PI, rot * Eigen::Vector3f::UnitX()).toRotationMatrix();
+    //                rot = flip * rot;
+    //            }
+    switch (rotation_format) {
+    case RotationFormat::Exponential: {
+        Eigen::AngleAxisf aa(rot);
+        Eigen::Vector3f v = aa.angle() * aa.axis();
+        trajectory_stream << v.x() << sep << v.y() << sep << v.z() << sep << "\n";
+        break;
+    } case RotationFormat::Matrix: {
+        Eigen::IOFormat in_line_format(Eigen::StreamPrecision, Eigen::DontAlignCols, sep, sep);
+        trajectory_stream << rot.format(in_line_format) << "\n";
+        break;
+    } case RotationFormat::Quaternion: {
+        Eigen::Quaternionf q(rot);
+        trajectory_stream << q.x() << sep << q.y() << sep << q.z() << sep << q.w() << "\n";
+        break;
+    } default:
+        break;
+    }
+}
+
+/// Keyframes of a sequence, selected by the motion of the camera. Only frame headers are read.
+std::vector<size_t> selectKeyframes(const SensReader& sens, const FrameChangeThresholds& thresholds){
+    std::vector<Pose> poses;
+    poses.reserve(sens.numFrames());
+    for(size_t i = 0; i < sens.numFrames(); i++){
+        const Eigen::Matrix4d m = Eigen::Map<const Eigen::Matrix<float, 4, 4, Eigen::RowMajor>>(sens.frameInfo(i).cameraToWorld).cast<double>();
+        poses.emplace_back(m);
+    }
+    return selectKeyframes(poses, thresholds);
+}
+
+/// Per-thread decoder and buffers, which are reused between frames
+struct FrameBuffers {
+    SensDecoder decoder;
+    Mat depth_raw, rgb, registered, map;
+    std::vector<uchar> encoded;
+};
+
+/// Write depth (png) and colour (jpg) of frame i, registered as requested
+void extractFrame(const SensReader& sens, size_t i, const string& frames_directory, Registration registration,
+                  const DepthRegistration* warp, FrameBuffers& b){
+    const SensFrameInfo& frame = sens.frameInfo(i);
+    uint64_t ts = frameTimestamp(frame, i);
+
+    // Frames are extracted in parallel already, hence rows are not warped in parallel
+    sens.readDepth(i, b.depth_raw, b.decoder);
+    const Mat* depth = &b.depth_raw;
+    if(registration == Registration::Depth){
+        warp->registerDepth(b.depth_raw, b.registered, false);
+        depth = &b.registered;
+    }
+    if(!cv::imencode(".png", *depth, b.encoded)) throw std::runtime_error("Could not encode depth of frame " + to_string(i) + ".");
+    writeFileBytes(frames_directory + 'd' + std::to_string(ts) + ".png", b.encoded.data(), b.encoded.size());
+
+    // JPEG colour is written as stored, which avoids decoding and a second lossy compression
+    const string rgbPath = frames_directory + "rgb" + std::to_string(ts) + ".jpg";
+    if(sens.colorCodec == SensColorCodec::Jpeg && registration != Registration::Color){
+        writeFileBytes(rgbPath, sens.colorData(i), frame.colorSize);
+    } else {
+        sens.readColor(i, b.rgb, b.decoder);
+        const Mat* rgb = &b.rgb;
+        if(registration == Registration::Color){
+            warp->registerColor(b.depth_raw, b.rgb, b.registered, b.map, false);
+            rgb = &b.registered;
+        }
+        if(!cv::imencode(".jpg", *rgb, b.encoded)) throw std::runtime_error("Could not encode colour of frame " + to_string(i) + ".");
+        writeFileBytes(rgbPath, b.encoded.data(), b.encoded.size());
+    }
+}
+
+/**
+ * @brief Measure colour and depth decoding throughput on up to 'maxFrames' frames, spread over the file. The reference
+ * mimics ml::SensorData: stb_image, with a new buffer per frame.
+ */
+void benchmarkDecoding(const SensReader& sens, size_t maxFrames = 200){
+    std::vector<size_t> frames;
+    const size_t step = std::max<size_t>(1, sens.numFrames() / maxFrames);
+    for(size_t i = 0; i < sens.numFrames() && frames.size() < maxFrames; i += step) frames.push_back(i);
+    if(frames.empty()){
+        cout << "The file does not contain any frames, nothing to benchmark." << endl;
+        return;
+    }
+    for(size_t i : frames) sens.prefetch(i);
+
+    auto measure = [&](const string& name, std::function<void(size_t)> decodeFrame){
+        auto t0 = std::chrono::steady_clock::now();
+        for(size_t i : frames) decodeFrame(i);
+        double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0).count();
+        cout << std::left << std::setw(40) << name << std::fixed << std::setprecision(3) << ms / frames.size() << " ms/frame" << endl;
+    };
+
+    cout << "Decoding " << frames.size() << " frames per run (" << SensDecoder::describe() << ")..." << endl;
+    SensDecoder decoder;
+    Mat rgb, depth;
+
+    if(sens.colorCodec == SensColorCodec::Jpeg || sens.colorCodec == SensColorCodec::Png){
+        measure("colour: stb_image, new buffer per frame", [&](size_t i){
+            Mat bgr(sens.colorHeight, sens.colorWidth, CV_8UC3);
+            decodeImageStb(sens.colorData(i), sens.frameInfo(i).colorSize, bgr);
+        });
+        measure("colour: cv::imdecode", [&](size_t i){
+            rgb = cv::imdecode(Mat(1, sens.frameInfo(i).colorSize, CV_8UC1, (void*)sens.colorData(i)), cv::IMREAD_COLOR);
+        });
+    }
+    measure("colour: SensDecoder, reused buffer", [&](size_t i){ sens.readColor(i, rgb, decoder); });
+
+    if(sens.depthCodec == SensDepthCodec::Zlib){
+        measure("depth: stb_image, new buffer per frame", [&](size_t i){
+            int length;
+            char* inflated = sens_stb::stbi_zlib_decode_malloc((const char*)sens.depthData(i), sens.frameInfo(i).depthSize, &length);
+            if(!inflated) throw std::runtime_error("Could not decompress depth of frame " + to_string(i) + ".");
+            free(inflated);
+        });
+    }
+    measure("depth: SensDecoder, reused buffer", [&](size_t i){ sens.readDepth(i, depth, decoder); });
+}
 
 int main(int argc, char* argv[])
 {
@@ -35,32 +211,35 @@ int main(int argc, char* argv[])
     if(!parser.hasOption("-i")){
         cout << "A tool to extract scannet *.sens data.\n\n";
         cout << "Error, invalid arguments.\n"
-                "Mandatory -i: input *.sens file\n"
-                "Optional -ot: Output trajectory file.\n"
-                "Optional -of: Output directory for rgb and depth frames.\n"
+                "Mandatory -i: input *.sens file, or *.txt file listing sequence names (batch mode).\n"
+                "Optional -ot: Output trajectory file (batch mode: directory, trajectories are stored as <name>.txt).\n"
+                "Optional -of: Output directory for rgb and depth frames (batch mode: frames are stored in <name>/).\n"
                 "Optional --rotation_format: Either 'matrix', 'quaternion' or 'exponential' [default is exponential]\n"
+                "Optional --threads: Number of threads extracting frames [default is the number of cores]\n"
+                "Optional --keyframes: Only extract keyframes, which are selected by camera motion. The trajectory only contains keyframes.\n"
+                "Optional --translation: Keyframes, minimum camera translation since the last keyframe [m] [default is 0.05]\n"
+                "Optional --rotation: Keyframes, minimum camera rotation since the last keyframe [deg] [default is 5]\n"
+                "Optional --maxskip: Keyframes, never skip more than this number of consecutive frames [default is 0, unlimited]\n"
+                "Optional --register: Either 'depth' (depth is warped into the colour camera, at colour resolution) or 'color'\n"
+                "                     (colour is warped into the depth camera, at depth resolution) [default is none, frames are stored as recorded]\n"
+                "Optional --benchmark: Only measure the decoding speed of colour and depth frames, nothing is exported.\n"
+                "Optional --root: Batch mode, dataset directory, containing <name>/<name>.sens [default is the current directory]\n"
+                "Optional --manifest: Batch mode, file listing completed sequences, which are skipped when restarting\n"
+                "                     [default is manifest.txt in the -of directory, or else the -ot directory]\n"
                 "\n"
-                "Example: ./convert_scannet_sens -i <filename>.sens -ot <filename>.txt" << endl;
+                "Example: ./convert_scannet_sens -i <filename>.sens -ot <filename>.txt\n"
+                "Example: ./convert_scannet_sens -i scannetv2_train.txt --root scans -of frames -ot trajectories\n"
+                "Example: ./convert_scannet_sens -i <filename>.sens -of frames -ot <filename>.txt --keyframes --maxskip 30" << endl;
 
         return 1;
     }
 
     // Input data
     string filename = parser.getStringOption("-i");
-    cout << "Loading data ... ";
-    cout.flush();
-    ml::SensorData sd(filename);
-    cout << "done!" << endl;
-    cout << sd << endl;
-
-    // Prepare writing trajectories
+    const bool batch = filename.substr(filename.find_last_of(".") + 1) == "txt";
     bool export_trajectory = parser.hasOption("-ot");
     bool export_frames = parser.hasOption("-of");
-
     string frames_directory = parser.getDirOption("-of");
-    if(!exists(frames_directory)){
-        createDirectory(frames_directory);
-    }
 
     RotationFormat rotation_format = RotationFormat::Exponential;
     if(parser.hasOption("--rotation_format")){
@@ -72,91 +251,224 @@ int main(int argc, char* argv[])
         else throw std::invalid_argument("unknown rotation format");
     }
 
-    string trajectory_filename;
-    std::ofstream trajectory_stream;
-    const string sep = "\t";
-    if(export_trajectory){
-        trajectory_filename = parser.getStringOption("-ot");
-        trajectory_stream.open(trajectory_filename);
+    Registration registration = Registration::None;
+    if(parser.hasOption("--register")){
+        string target = parser.getStringOption("--register");
+        boost::algorithm::to_lower(target);
+        if(target == "depth") registration = Registration::Depth;
+        else if(target == "color" || target == "colour") registration = Registration::Color;
+        else throw std::invalid_argument("unknown registration, expected 'depth' or 'color'");
     }
 
-    Progress progress(sd.m_frames.size());
+    // Keyframes only depend on camera poses, which are stored in the frame headers
+    const bool keyframes = parser.hasOption("--keyframes");
+    FrameChangeThresholds thresholds;
+    thresholds.translation = parser.getDoubleOption("--translation", 0.05);
+    thresholds.rotation = parser.getDoubleOption("--rotation", 5);
+    thresholds.maxSkip = std::max(0, parser.getIntOption("--maxskip", 0));
 
-    #pragma omp parallel for num_threads(12) ordered schedule(static,1)
-    for (size_t i = 0; i < sd.m_frames.size(); i++) {
+    auto selectFrames = [&](Sequence& sequence){
+        SensReader& sens = *sequence.sens;
+        if(sequence.framesDirectory.empty() || keyframes){
+            // Trajectories and keyframes only need frame headers, payloads are skipped
+            const size_t numComplete = sens.scanHeaders();
+            if(numComplete != sens.numFrames()) throw std::runtime_error("Sens file is truncated after " + std::to_string(numComplete) + " frames.");
+        }
+        if(registration != Registration::None && !sequence.framesDirectory.empty()){
+            // Warp tables are computed once per sequence, as the calibration may differ between sequences
+            sequence.registration.reset(new DepthRegistration(createDepthRegistration(
+                sens.calibrationDepth.intrinsic, sens.calibrationDepth.extrinsic, Size(sens.depthWidth, sens.depthHeight),
+                sens.calibrationColor.intrinsic, sens.calibrationColor.extrinsic, Size(sens.colorWidth, sens.colorHeight),
+                1.0 / sens.depthShift)));
+        }
+        if(keyframes){
+            sequence.frames = selectKeyframes(sens, thresholds);
+        } else {
+            sequence.frames.resize(sens.numFrames());
+            std::iota(sequence.frames.begin(), sequence.frames.end(), 0);
+        }
+    };
+
+    // Sequences to extract. In batch mode, sequences are opened lazily by the reader thread.
+    std::vector<std::shared_ptr<Sequence>> sequences;
+    string root, manifest_filename;
+    std::set<string> completed;
+    if(batch){
+        if(parser.hasOption("--benchmark")) throw std::invalid_argument("--benchmark requires a *.sens file.");
+        if(!export_frames && !export_trajectory) throw std::invalid_argument("Batch mode requires -of and/or -ot.");
+        root = parser.getDirOption("--root", parser.hasOption("--root"));
+        string trajectory_directory = parser.getDirOption("-ot");
+        if(export_frames && !exists(frames_directory)) createDirectory(frames_directory);
+        if(export_trajectory && !exists(trajectory_directory)) createDirectory(trajectory_directory);
+        manifest_filename = parser.getStringOption("--manifest", (export_frames ? frames_directory : trajectory_directory) + "manifest.txt");
+        if(exists(manifest_filename))
+            for(const string& name : readFileLines(manifest_filename, true)) completed.insert(name);
+
+        for(const string& name : readFileLines(filename, true)){
+            if(completed.count(name)) continue;
+            std::shared_ptr<Sequence> sequence(new Sequence());
+            sequence->name = name;
+            if(export_frames) sequence->framesDirectory = frames_directory + name + "/";
+            if(export_trajectory) sequence->trajectoryFilename = trajectory_directory + name + ".txt";
+            sequences.push_back(sequence);
+        }
+        cout << "Extracting " << sequences.size() << " sequences (" << completed.size() << " were completed before)..." << endl;
+    } else {
+        std::shared_ptr<Sequence> sequence(new Sequence());
+        sequence->name = filename;
+        sequence->sens.reset(new SensReader(filename));
+        cout << *sequence->sens << endl;
 
-        const ml::SensorData::RGBDFrame& frame = sd.m_frames[i];
-        uint64_t ts = std::max(std::max(frame.getTimeStampColor(), frame.getTimeStampDepth()), i);
+        if(parser.hasOption("--benchmark")){
+            benchmarkDecoding(*sequence->sens);
+            return 0;
+        }
 
-        //de-compress color and depth values
-        if(export_frames){
-            ml::vec3uc* colorData = sd.decompressColorAlloc(i);
-            unsigned short* depthData = sd.decompressDepthAlloc(i);
+        if(export_frames && !exists(frames_directory)) createDirectory(frames_directory);
+        sequence->framesDirectory = export_frames ? frames_directory : "";
+        sequence->trajectoryFilename = parser.getStringOption("-ot");
+        selectFrames(*sequence);
+        if(keyframes) cout << "Selected " << sequence->frames.size() << " keyframes of " << sequence->sens->numFrames() << " frames." << endl;
+        sequences.push_back(sequence);
+    }
 
-            Mat depth_raw(sd.m_depthHeight, sd.m_depthWidth, CV_16UC1, depthData);
-            Mat rgb(sd.m_colorHeight, sd.m_colorWidth, CV_8UC3, (unsigned char*)colorData);
-            cvtColor(rgb, rgb, cv::COLOR_BGR2RGB);
+    // Frames of all sequences are extracted by one pool of workers:
+    // [reader: opens sequences, dispatches frames] -> [workers: decode, encode, write] -> [main thread: ordered output]
+    // Hence, small sequences do not leave cores idle. Workers keep their decode and encode buffers, and never wait for
+    // each other, since the order of each sequence is restored by the main thread.
+    const size_t numThreads = export_frames ? std::max(1, parser.getIntOption("--threads", defaultThreadCount())) : 1;
+    BoundedQueue<FrameTask> tasks(4 * numThreads);
+    BoundedQueue<FrameTask> done(4 * numThreads);
+    ThreadErrors errors;
+    std::atomic<size_t> activeWorkers(numThreads);
+    std::vector<std::thread> threads;
 
-            cv::imwrite(frames_directory + 'd' + std::to_string(ts) + ".png", depth_raw);
-            cv::imwrite(frames_directory + "rgb" + std::to_string(ts) + ".jpg", rgb);
+    auto closeQueues = [&](){
+        tasks.close();
+        done.close();
+    };
 
-            free(colorData);
-            free(depthData);
-        }
+    // Reader: dispatches frames in order and lets the kernel fetch their payloads ahead of time
+    threads.emplace_back([&](){
+        if(!errors.capture([&](){
+            for(std::shared_ptr<Sequence>& sequence : sequences){
+                FrameTask task;
+                task.sequence = sequence;
+                try {
+                    if(!sequence->sens){
+                        sequence->sens.reset(new SensReader(root + sequence->name + "/" + sequence->name + ".sens"));
+                        selectFrames(*sequence);
+                    }
+                    if(!sequence->framesDirectory.empty() && !exists(sequence->framesDirectory)) createDirectory(sequence->framesDirectory);
 
-        #pragma omp ordered
-        {
-            if(export_trajectory){
-                ml::mat4f t = frame.getCameraToWorld();
-                if(t.matrix[15] != 1 || t.matrix[14] != 0 || t.matrix[13] != 0 || t.matrix[12] != 0)
-                    throw invalid_argument("sens file contains illegal transformation in frame ["+to_string(i)+"], last row of matrix: " +
-                                           to_string(t.matrix[12]) + " " +
-                                           to_string(t.matrix[13]) + " " +
-                                           to_string(t.matrix[14]) + " " +
-                                           to_string(t.matrix[15]));
-
-                Eigen::Matrix3f rot;
-                Eigen::Vector3f trans;
-                rot << t.matrix[0], t.matrix[1], t.matrix[2],
-                        t.matrix[4], t.matrix[5], t.matrix[6],
-                        t.matrix[8], t.matrix[9], t.matrix[10];
-                trans << t.matrix[3], t.matrix[7], t.matrix[11];
-
-                trajectory_stream   << ts << sep << trans(0) << sep << trans(1) << sep << trans(2) << sep;
-
-                //            if(true) {
-                //                Eigen::Matrix3f flip = Eigen::AngleAxisf(M_PI, rot * Eigen::Vector3f::UnitX()).toRotationMatrix();
-                //                rot = flip * rot;
-                //            }
-                switch (rotation_format) {
-                case RotationFormat::Exponential: {
-                    Eigen::AngleAxisf aa(rot);
-                    Eigen::Vector3f v = aa.angle() * aa.axis();
-                    trajectory_stream << v.x() << sep << v.y() << sep << v.z() << sep << "\n";
-                    break;
-                } case RotationFormat::Matrix: {
-                    Eigen::IOFormat in_line_format(Eigen::StreamPrecision, Eigen::DontAlignCols, sep, sep);
-                    trajectory_stream << rot.format(in_line_format) << "\n";
-                    break;
-                } case RotationFormat::Quaternion: {
-                    Eigen::Quaternionf q(rot);
-                    trajectory_stream << q.x() << sep << q.y() << sep << q.z() << sep << q.w() << "\n";
-                    break;
-                } default:
-                    break;
+                    for(size_t i = 0; i < sequence->frames.size() && !sequence->failed; i++){
+                        task.index = i;
+                        task.frame = sequence->frames[i];
+                        if(!sequence->framesDirectory.empty()) sequence->sens->prefetch(task.frame);
+                        if(!tasks.push(task)) return;
+                    }
+                } catch(const std::exception& e) {
+                    // Reported by the main thread, other sequences continue
+                    task.error = e.what();
+                    task.index = task.frame = std::numeric_limits<size_t>::max();
+                    sequence->failed = true;
+                    if(!done.push(task)) return;
                 }
             }
+        })) closeQueues();
+        tasks.close();
+    });
 
+    for(size_t t = 0; t < numThreads; t++){
+        threads.emplace_back([&](){
+            FrameBuffers buffers;
+            if(!errors.capture([&](){
+                FrameTask task;
+                while(tasks.pop(task)){
+                    Sequence& sequence = *task.sequence;
+                    if(!sequence.failed && !sequence.framesDirectory.empty()){
+                        try {
+                            extractFrame(*sequence.sens, task.frame, sequence.framesDirectory, registration, sequence.registration.get(), buffers);
+                        } catch(const std::exception& e) {
+                            task.error = e.what();
+                        }
+                    }
+                    if(!done.push(std::move(task))) break;
+                }
+            })) closeQueues();
+            if(--activeWorkers == 0) done.close();
+        });
+    }
 
-            progress.show();
-        }
+    // Main thread: trajectories, progress and manifest
+    std::unique_ptr<Progress> progress(batch ? nullptr : new Progress(sequences[0]->frames.size()));
+    std::ofstream manifest;
+    if(batch){
+        manifest.open(manifest_filename, std::ios::app);
+        if(!manifest.is_open()) throw std::invalid_argument("Could not open manifest: " + manifest_filename);
     }
+    size_t numCompleted = 0, numFailed = 0;
+    string firstError;
+
+    auto fail = [&](Sequence& sequence, const string& error){
+        sequence.failed = true;
+        if(sequence.reported) return;
+        sequence.reported = true;
+        if(firstError.empty()) firstError = error;
+        numFailed++;
+        if(batch) cout << "Failed to extract " << sequence.name << ": " << error << endl;
+    };
+
+    errors.capture([&](){
+        FrameTask task;
+        while(done.pop(task)){
+            Sequence& sequence = *task.sequence;
+            if(!task.error.empty()) fail(sequence, task.error);
+            if(sequence.failed) continue;
+
+            sequence.order.push(task.index, task.frame, [&](size_t i){
+                try {
+                    if(sequence.order.numEmitted() == 0 && !sequence.trajectoryFilename.empty()){
+                        sequence.trajectory.open(sequence.trajectoryFilename);
+                        if(!sequence.trajectory.is_open()) throw std::runtime_error("Could not open " + sequence.trajectoryFilename);
+                    }
+                    if(sequence.trajectory.is_open()) writeTrajectoryLine(sequence.trajectory, sequence.sens->frameInfo(i), i, rotation_format);
+                } catch(const std::exception& e) {
+                    fail(sequence, e.what());
+                    return;
+                }
+                if(progress) progress->show();
+            });
+
+            // Sequence completed
+            if(!sequence.failed && sequence.order.numEmitted() == sequence.frames.size()){
+                sequence.trajectory.close();
+                sequence.sens.reset();
+                numCompleted++;
+                if(batch){
+                    manifest << sequence.name << endl;
+                    cout << "[" << numCompleted + numFailed << "/" << sequences.size() << "] Extracted " << sequence.name;
+                    if(keyframes) cout << " (" << sequence.frames.size() << " keyframes)";
+                    cout << endl;
+                }
+            }
+        }
+    });
+    closeQueues();
+    for(std::thread& t : threads) t.join();
+    errors.rethrow();
 
-    if(export_trajectory){
-        trajectory_stream.close();
+    // Sequences without (key)frames never reach the main thread
+    for(std::shared_ptr<Sequence>& sequence : sequences){
+        if(sequence->failed || !sequence->sens || !sequence->frames.empty()) continue;
+        if(!sequence->trajectoryFilename.empty()) std::ofstream(sequence->trajectoryFilename).close();
+        numCompleted++;
+        if(batch) manifest << sequence->name << endl;
     }
 
     cout << endl;
+    if(!batch && numFailed) throw std::runtime_error(firstError);
+    if(batch) cout << "Extracted " << numCompleted << " sequences, " << numFailed << " failed." << endl;
 
-    return 0;
+    return numFailed ? 1 : 0;
 }
@@ -0,0 +1,156 @@
+/******************************************************************
+This file is part of https://github.com/martinruenz/dataset-tools
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>
+*****************************************************************/
+
+/**
+ * Convert rgb and depth images (e.g. renderings) to a scannet *.sens file, with JPEG colour and zlib depth.
+ *
+ * Images are loaded and encoded by the workers of ParallelSensWriter, see ../common/common_sens.h.
+ */
+
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include "../common/common.h"
+#include "../common/common_3d.h"
+#include "../common/common_sens.h"
+
+using namespace std;
+using namespace cv;
+
+int main(int argc, char* argv[])
+{
+    Parser parser(argc, argv);
+
+    if(!parser.hasOption("--out") || ((!parser.hasOption("--rgbdir") || !parser.hasOption("--depthdir")) && !parser.hasOption("--associations"))){
+        cout << "A tool to convert rgb and depth images to a scannet *.sens file.\n\n";
+        cout << "Error, invalid arguments.\n"
+                "Mandatory --rgbdir: Path to directory containing rgb images (unless --associations is used).\n"
+                "Mandatory --depthdir: Path to directory containing depth images (unless --associations is used).\n"
+                "Mandatory --out: Output *.sens path.\n"
+                "Optional --associations: TUM association file (ts_rgb rgb_path ts_depth depth_path), paths are relative to the file.\n"
+                "Optional --fps: Frames per second, if there are no timestamps (default: 30).\n"
+                "Optional --timestamps: File that provides a timestamp for each frame (one per line).\n"
+                "Optional --tss: Timestamp scaling factor (default: 1, or 1000000 for associated frames, as TUM timestamps are in seconds).\n"
+                "Optional -s: Factor, which scales depth values to [m] (default: 1.00).\n"
+                "Optional --poses: File with one TUM pose (ts tx ty tz qx qy qz qw) per frame. Otherwise, poses are marked as invalid.\n"
+                "Optional --fx, --fy, --cx, --cy: Depth intrinsics (default: 528, 528, width/2, height/2).\n"
+                "Optional --sensor: Sensor name (default: images).\n"
+                "Optional --quality: JPEG quality (default: 90).\n"
+                "Optional --threads: Number of threads used to load and encode frames (default: number of cores).\n"
+                "\n"
+                "Example: ./convert_imagesToSens --rgbdir rgb --depthdir depth --poses poses.txt --out scene.sens" << endl;
+        return 1;
+    }
+
+    // Input
+    string dirRGB = parser.getDirOption("--rgbdir");
+    string dirDepth = parser.getDirOption("--depthdir");
+    double tss = parser.getDoubleOption("--tss", parser.hasOption("--associations") ? 1000000 : 1);
+    vector<string> inputRGBs, inputDepths, timestamps;
+    if(parser.hasOption("--associations")){
+        const string file = parser.getOption("--associations");
+        dirRGB = dirDepth = getDirectory(file);
+        for(const string& line : readFileLines(file, true)){
+            if(line[0] == '#') continue;
+            vector<string> columns = splitString(line, ' ', false);
+            if(columns.size() < 4) throw invalid_argument("Could not parse association: " + line);
+            timestamps.push_back(columns[0]);
+            inputRGBs.push_back(columns[1]);
+            inputDepths.push_back(columns[3]);
+        }
+    } else {
+        inputRGBs = getFilenames(dirRGB, { ".jpg", ".png"});
+        inputDepths = getFilenames(dirDepth, { ".exr", ".png"});
+    }
+    if(inputRGBs.size() == 0 || inputRGBs.size() != inputDepths.size()) throw invalid_argument("Input is empty or not matching.");
+    if(parser.hasOption("--timestamps")){
+        timestamps = readFileLines(parser.getOption("--timestamps"), true);
+        if(timestamps.size() != inputRGBs.size()) throw invalid_argument("Number of input timestamps != number of images");
+    }
+    const uint64_t timeStep = 1000000 / parser.getDoubleOption("--fps", 30);
+
+    vector<Pose> poses;
+    if(parser.hasOption("--poses")){
+        for(const string& line : readFileLines(parser.getOption("--poses"), true)){
+            if(line[0] == '#') continue;
+            double ts, tx, ty, tz, qx, qy, qz, qw;
+            std::istringstream iss(line);
+            if(!(iss >> ts >> tx >> ty >> tz >> qx >> qy >> qz >> qw)) throw invalid_argument("Could not parse pose: " + line);
+            poses.emplace_back(Eigen::Vector3d(tx, ty, tz), Eigen::Quaterniond(qw, qx, qy, qz), ts);
+        }
+        if(poses.size() != inputRGBs.size()) throw invalid_argument("Number of poses != number of images");
+    }
+
+    // The resolution is taken from the first frame, ParallelSensWriter checks all other frames
+    Mat firstRGB = imread(dirRGB + inputRGBs[0]);
+    Mat firstDepth = imread(dirDepth + inputDepths[0], cv::IMREAD_UNCHANGED);
+    if(firstRGB.total() == 0) throw invalid_argument("Could not read rgb-image file: " + dirRGB + inputRGBs[0]);
+    if(firstDepth.total() == 0) throw invalid_argument("Could not read depth-image file: " + dirDepth + inputDepths[0]);
+
+    SensHeader header;
+    header.sensorName = parser.getStringOption("--sensor", "images");
+    header.colorCodec = SensColorCodec::Jpeg;
+    header.depthCodec = SensDepthCodec::Zlib;
+    header.colorWidth = firstRGB.cols;
+    header.colorHeight = firstRGB.rows;
+    header.depthWidth = firstDepth.cols;
+    header.depthHeight = firstDepth.rows;
+    header.depthShift = 1000; // Depth is stored in mm
+    const float depthScale = 1000 * parser.getFloatOption("-s", 1.0);
+    const float identity[16] = { 1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1 };
+    std::copy(identity, identity + 16, header.calibrationDepth.intrinsic);
+    std::copy(identity, identity + 16, header.calibrationDepth.extrinsic);
+    header.calibrationDepth.intrinsic[0] = parser.getFloatOption("--fx", 528);
+    header.calibrationDepth.intrinsic[5] = parser.getFloatOption("--fy", 528);
+    header.calibrationDepth.intrinsic[2] = parser.getFloatOption("--cx", 0.5 * firstDepth.cols);
+    header.calibrationDepth.intrinsic[6] = parser.getFloatOption("--cy", 0.5 * firstDepth.rows);
+    // Colour is assumed to be registered to depth, its intrinsics are scaled to its resolution
+    header.calibrationColor = header.calibrationDepth;
+    const float scaleX = float(firstRGB.cols) / firstDepth.cols, scaleY = float(firstRGB.rows) / firstDepth.rows;
+    header.calibrationColor.intrinsic[0] *= scaleX;
+    header.calibrationColor.intrinsic[2] *= scaleX;
+    header.calibrationColor.intrinsic[5] *= scaleY;
+    header.calibrationColor.intrinsic[6] *= scaleY;
+
+    // Frames are loaded and encoded by the workers of the writer
+    const string outfile = parser.getOption("--out");
+    const size_t numThreads = std::max(1, parser.getIntOption("--threads", defaultThreadCount()));
+    ParallelSensWriter writer(outfile, header, numThreads, parser.getIntOption("--quality", 90));
+    Progress progress(inputRGBs.size());
+    for(size_t i = 0; i < inputRGBs.size(); i++){
+        writer.write([&, i](SensWriterFrame& frame){
+            const string pathRGB = dirRGB + inputRGBs[i];
+            const string pathDepth = dirDepth + inputDepths[i];
+            frame.color = imread(pathRGB);
+            frame.depth = imread(pathDepth, cv::IMREAD_UNCHANGED);
+            if(frame.color.total() == 0) throw std::invalid_argument("Could not read rgb-image file: " + pathRGB);
+            if(frame.depth.total() == 0) throw std::invalid_argument("Could not read depth-image file: " + pathDepth);
+            if(depthScale != 1 || frame.depth.type() != CV_16UC1) frame.depth.convertTo(frame.depth, CV_16UC1, depthScale);
+
+            frame.timeStampColor = frame.timeStampDepth = timestamps.size() ? uint64_t(std::stod(timestamps[i]) * tss) : i * timeStep;
+            if(poses.size()){
+                const Eigen::Matrix4d m = poses[i].toMatrix();
+                for(int r = 0; r < 4; r++) for(int c = 0; c < 4; c++) frame.cameraToWorld[4*r+c] = m(r,c);
+            }
+        });
+        progress.show();
+    }
+    writer.close();
+    cout << "\nWrote " << writer.numFrames() << " frames to " << outfile << endl;
+
+    return 0;
+}
@@ -0,0 +1,349 @@
+/******************************************************************
+This file is part of https://github.com/martinruenz/dataset-tools
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>
+*****************************************************************/
+
+/**
+ * Convert scannet *.sens files to KLG files and vice versa.
+ *
+ * Both formats store zlib compressed 16bit depth and JPEG compressed colour per frame, hence depth payloads are copied
+ * as they are, whenever the codec and resolution allow it. Colour is only copied with -copyjpg, since KLG files (like
+ * Logger2) store JPEGs with swapped red and blue channels, see convert_imagesToKlg. Otherwise, colour is decoded and
+ * re-encoded in the order expected by the output format.
+ *
+ * KLG files are written as v2 files, including intrinsics, depth scale and camera poses ("pose" stream).
+ */
+
+#include <array>
+#include <cmath>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <memory>
+#include "../common/common.h"
+#include "../common/common_3d.h"
+#include "../common/common_klg.h"
+#include "../common/common_registration.h"
+#include "../common/common_sens.h"
+#include "../common/common_threading.h"
+
+using namespace std;
+using namespace cv;
+
+struct TranscodedFrame {
+    size_t index = 0;
+    bool copyColor = false; // Colour payload is copied from the input file
+    bool copyDepth = false; // Depth payload is copied from the input file
+    std::vector<unsigned char> color;
+    std::vector<unsigned char> depth;
+};
+
+/// Per-thread decoding state and buffers
+struct TranscodeBuffers {
+    SensDecoder sensDecoder;
+    JPEGLoader jpeg;
+    Mat rgb, rgbResized, depth, map;
+};
+
+/// Camera-to-world transformation of a scannet frame as TUM pose (tx ty tz qx qy qz qw)
+std::array<double,7> toTumPose(const float* m){
+    Eigen::Matrix4d matrix;
+    for(int r = 0; r < 4; r++) for(int c = 0; c < 4; c++) matrix(r,c) = m[4*r+c];
+    Pose pose(matrix);
+    return { pose.t.x(), pose.t.y(), pose.t.z(), pose.q.x(), pose.q.y(), pose.q.z(), pose.q.w() };
+}
+
+/**
+ * @brief Run 'transcode' for all frames on a pool of workers and hand the results to 'write', in order.
+ */
+void transcodeFrames(size_t numFrames, size_t numThreads,
+                     std::function<void(size_t)> prefetch,
+                     std::function<void(TranscodedFrame&, TranscodeBuffers&)> transcode,
+                     std::function<void(const TranscodedFrame&)> write){
+    BoundedQueue<size_t> tasks(2 * numThreads);
+    BoundedQueue<TranscodedFrame> done(2 * numThreads);
+    ReorderWindow window(4 * numThreads); // Frames ahead of 'write'
+    ThreadErrors errors;
+    std::atomic<size_t> activeWorkers(numThreads);
+    std::vector<std::thread> threads;
+
+    auto closeQueues = [&](){
+        tasks.close();
+        done.close();
+        window.close();
+    };
+
+    threads.emplace_back([&](){
+        if(!errors.capture([&](){
+            for(size_t i = 0; i < numFrames; i++){
+                if(!window.acquire()) break;
+                prefetch(i);
+                if(!tasks.push(i)) break;
+            }
+        })) closeQueues();
+        tasks.close();
+    });
+
+    for(size_t t = 0; t < numThreads; t++){
+        threads.emplace_back([&](){
+            TranscodeBuffers buffers;
+            if(!errors.capture([&](){
+                size_t i;
+                while(tasks.pop(i)){
+                    TranscodedFrame frame;
+                    frame.index = i;
+                    transcode(frame, buffers);
+                    if(!done.push(std::move(frame))) break;
+                }
+            })) closeQueues();
+            if(--activeWorkers == 0) done.close();
+        });
+    }
+
+    Progress progress(numFrames);
+    ReorderBuffer<TranscodedFrame> order;
+    errors.capture([&](){
+        TranscodedFrame frame;
+        while(done.pop(frame)){
+            const size_t index = frame.index;
+            order.push(index, std::move(frame), [&](const TranscodedFrame& f){
+                write(f);
+                progress.show();
+                window.release();
+            });
+        }
+    });
+    closeQueues();
+    for(std::thread& t : threads) t.join();
+    errors.rethrow();
+}
+
+void sensToKlg(Parser& parser, const string& input, const string& output, size_t numThreads){
+    SensReader sens(input);
+    cout << sens << endl;
+
+    // KLG frames have a single resolution, colour is resized (or with -register, warped) to the depth resolution
+    const int width = sens.depthWidth;
+    const int height = sens.depthHeight;
+    const bool copyJpeg = parser.hasOption("-copyjpg");
+    const int jpegQuality = parser.getIntOption("-quality", 90);
+    const bool forcedCodec = parser.hasOption("-depthcodec");
+    const KlgDepthCodec depthCodec = forcedCodec ? parseKlgDepthCodec(parser.getOption("-depthcodec")) : KlgDepthCodec::Zlib;
+    const bool resizeColor = sens.colorWidth != sens.depthWidth || sens.colorHeight != sens.depthHeight;
+    std::unique_ptr<DepthRegistration> registration;
+    if(parser.hasOption("-register")){
+        registration.reset(new DepthRegistration(createDepthRegistration(
+            sens.calibrationDepth.intrinsic, sens.calibrationDepth.extrinsic, Size(sens.depthWidth, sens.depthHeight),
+            sens.calibrationColor.intrinsic, sens.calibrationColor.extrinsic, Size(sens.colorWidth, sens.colorHeight),
+            1.0 / sens.depthShift)));
+    }
+    if(copyJpeg && (resizeColor || registration)) cout << "Colour is resampled to " << width << "x" << height << ", hence -copyjpg has no effect." << endl;
+
+    KlgMetadata metadata;
+    metadata.width = width;
+    metadata.height = height;
+    metadata.fx = sens.calibrationDepth.intrinsic[0];
+    metadata.fy = sens.calibrationDepth.intrinsic[5];
+    metadata.cx = sens.calibrationDepth.intrinsic[2];
+    metadata.cy = sens.calibrationDepth.intrinsic[6];
+    metadata.depthScale = 1.0f / sens.depthShift;
+    KlgWriter writer(output);
+    writer.enableFooter(metadata, { "pose" });
+
+    std::ofstream trajectory;
+    if(parser.hasOption("-ot")){
+        trajectory.open(parser.getOption("-ot"));
+        if(!trajectory.is_open()) throw std::invalid_argument("Could not open trajectory file: " + parser.getOption("-ot"));
+        trajectory << std::fixed << std::setprecision(6);
+    }
+
+    transcodeFrames(sens.numFrames(), numThreads, [&](size_t i){ sens.prefetch(i); },
+                    [&](TranscodedFrame& frame, TranscodeBuffers& b){
+        const size_t i = frame.index;
+
+        // Depth
+        frame.copyDepth = !forcedCodec && (sens.depthCodec == SensDepthCodec::Zlib || sens.depthCodec == SensDepthCodec::Raw);
+        if(!frame.copyDepth){
+            sens.readDepth(i, b.depth, b.sensDecoder);
+            compressKlgDepth(b.depth, frame.depth, depthCodec);
+        }
+
+        // Colour, like Logger2, the RGB-ordered data is encoded as if it was BGR
+        frame.copyColor = copyJpeg && !resizeColor && !registration && sens.colorCodec == SensColorCodec::Jpeg;
+        if(!frame.copyColor){
+            sens.readColor(i, b.rgb, b.sensDecoder);
+            Mat& rgb = resizeColor || registration ? b.rgbResized : b.rgb;
+            if(registration){
+                // Frames are transcoded in parallel already, hence rows are not warped in parallel
+                if(frame.copyDepth) sens.readDepth(i, b.depth, b.sensDecoder);
+                registration->registerColor(b.depth, b.rgb, b.rgbResized, b.map, false);
+            } else if(resizeColor){
+                cv::resize(b.rgb, b.rgbResized, Size(width, height), 0, 0, INTER_AREA);
+            }
+            cv::cvtColor(rgb, rgb, cv::COLOR_BGR2RGB);
+            cv::imencode(".jpg", rgb, frame.color, { cv::IMWRITE_JPEG_QUALITY, jpegQuality });
+        }
+    }, [&](const TranscodedFrame& frame){
+        const size_t i = frame.index;
+        const SensFrameInfo& info = sens.frameInfo(i);
+        uint64_t timestamp = info.timeStampDepth ? info.timeStampDepth : info.timeStampColor;
+        if(timestamp == 0) timestamp = i * 1000000 / 30;
+
+        const std::array<double,7> pose = toTumPose(info.cameraToWorld);
+        const unsigned char* depth = frame.copyDepth ? sens.depthData(i) : frame.depth.data();
+        const unsigned char* color = frame.copyColor ? sens.colorData(i) : frame.color.data();
+        writer.writeFrame(timestamp,
+                          depth, frame.copyDepth ? info.depthSize : frame.depth.size(),
+                          color, frame.copyColor ? info.colorSize : frame.color.size(),
+                          { { pose.data(), sizeof(pose) } });
+
+        // Invalid poses (scannet marks them with -inf) are left out of the trajectory
+        if(trajectory.is_open() && std::all_of(info.cameraToWorld, info.cameraToWorld + 16, [](float v){ return std::isfinite(v); })){
+            trajectory << timestamp / 1e6;
+            for(double v : pose) trajectory << " " << v;
+            trajectory << "\n";
+        }
+    });
+    writer.close();
+}
+
+void klgToSens(Parser& parser, const string& input, const string& output, size_t numThreads){
+    KlgReader klg(input);
+    int width = parser.getIntOption("-w", 640);
+    int height = parser.getIntOption("-h", 480);
+    SensHeader header;
+    header.sensorName = parser.getStringOption("-sensor", "klg");
+    header.colorCodec = SensColorCodec::Jpeg;
+    header.depthCodec = SensDepthCodec::Zlib;
+    const float identity[16] = { 1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1 };
+    std::copy(identity, identity + 16, header.calibrationColor.intrinsic);
+    std::copy(identity, identity + 16, header.calibrationColor.extrinsic);
+    std::copy(identity, identity + 16, header.calibrationDepth.intrinsic);
+    std::copy(identity, identity + 16, header.calibrationDepth.extrinsic);
+    if(klg.hasFooter()){
+        const KlgMetadata& metadata = klg.getMetadata();
+        if(!parser.hasOption("-w")) width = metadata.width;
+        if(!parser.hasOption("-h")) height = metadata.height;
+        for(SensCalibration* c : { &header.calibrationColor, &header.calibrationDepth }){
+            c->intrinsic[0] = metadata.fx;
+            c->intrinsic[5] = metadata.fy;
+            c->intrinsic[2] = metadata.cx;
+            c->intrinsic[6] = metadata.cy;
+        }
+        if(metadata.depthScale > 0) header.depthShift = 1.0f / metadata.depthScale;
+    }
+    header.colorWidth = header.depthWidth = width;
+    header.colorHeight = header.depthHeight = height;
+    const bool copyJpeg = parser.hasOption("-copyjpg");
+    const int jpegQuality = parser.getIntOption("-quality", 90);
+
+    // Poses, frames without a pose are marked as invalid (-inf), like in scannet
+    const int poseStream = klg.findStream("pose");
+    if(poseStream < 0) cout << "The KLG file has no 'pose' stream, poses are marked as invalid." << endl;
+
+    SensWriter writer(output, header);
+    transcodeFrames(klg.numFrames(), numThreads, [&](size_t i){ klg.prefetch(i); },
+                    [&](TranscodedFrame& frame, TranscodeBuffers& b){
+        const size_t i = frame.index;
+        const KlgFrameInfo& info = klg.frameInfo(i);
+
+        // Depth
+        frame.copyDepth = info.depthSize > 0 && klg.depthCodec(i, width, height) == KlgDepthCodec::Zlib;
+        if(!frame.copyDepth){
+            Mat depth = info.depthSize > 0 ? klg.readDepth(i, width, height, b.depth) : Mat::zeros(height, width, CV_16UC1);
+            if(!depth.isContinuous()) depth = depth.clone();
+            compressKlgDepth(depth, frame.depth, KlgDepthCodec::Zlib);
+        }
+
+        // Colour, KLG data is RGB-ordered (JPEGs are encoded as if it was BGR), scannet uses standard JPEGs
+        Mat rgbRaw = klg.imageView(i, width, height);
+        frame.copyColor = copyJpeg && rgbRaw.empty() && info.imageSize > 0;
+        if(!frame.copyColor){
+            if(!rgbRaw.empty()){
+                cvtColor(rgbRaw, b.rgb, cv::COLOR_RGB2BGR);
+            } else if(info.imageSize > 0){
+                // Decoding without channel swap yields BGR, see convert_klg
+                b.rgb.create(height, width, CV_8UC3);
+                b.jpeg.decode(klg.imageData(i), info.imageSize, b.rgb.data, width, height, false);
+            } else {
+                b.rgb.create(height, width, CV_8UC3);
+                b.rgb.setTo(0);
+            }
+            cv::imencode(".jpg", b.rgb, frame.color, { cv::IMWRITE_JPEG_QUALITY, jpegQuality });
+        }
+    }, [&](const TranscodedFrame& frame){
+        const size_t i = frame.index;
+        const KlgFrameInfo& info = klg.frameInfo(i);
+        const uint64_t timestamp = std::max<int64_t>(0, info.timestamp);
+
+        float cameraToWorld[16];
+        std::fill(cameraToWorld, cameraToWorld + 16, -std::numeric_limits<float>::infinity());
+        if(poseStream >= 0 && klg.streamSize(poseStream, i) == 7 * sizeof(double)){
+            double p[7];
+            memcpy(p, klg.streamData(poseStream, i), sizeof(p));
+            if(std::all_of(p, p + 7, [](double v){ return std::isfinite(v); })){
+                const Eigen::Matrix4d m = Pose(Eigen::Vector3d(p[0], p[1], p[2]), Eigen::Quaterniond(p[6], p[3], p[4], p[5])).toMatrix();
+                for(int r = 0; r < 4; r++) for(int c = 0; c < 4; c++) cameraToWorld[4*r+c] = m(r,c);
+            }
+        }
+
+        const unsigned char* depth = frame.copyDepth ? klg.depthData(i) : frame.depth.data();
+        const unsigned char* color = frame.copyColor ? klg.imageData(i) : frame.color.data();
+        writer.writeFrame(cameraToWorld, timestamp, timestamp,
+                          color, frame.copyColor ? info.imageSize : frame.color.size(),
+                          depth, frame.copyDepth ? info.depthSize : frame.depth.size());
+    });
+    writer.close();
+}
+
+int main(int argc, char* argv[])
+{
+    Parser parser(argc, argv);
+
+    if(!parser.hasOption("-i") || !parser.hasOption("-o")){
+        cout << "A tool to convert scannet *.sens files to KLG files and vice versa.\n\n";
+        cout << "Error, invalid arguments.\n"
+                "Mandatory -i: Input *.sens or *.klg file\n"
+                "Mandatory -o: Output *.klg or *.sens file\n"
+                "Optional -copyjpg: Copy JPEG colour payloads as stored, without decoding and re-encoding them (much faster and lossless).\n"
+                "   Note that KLG files store colour with swapped red and blue channels, which is not corrected by this option.\n"
+                "Optional -quality: JPEG quality of re-encoded colour (default: 90).\n"
+                "Optional -threads: Number of worker threads (default: number of cores).\n"
+                "sens -> klg:\n"
+                "Optional -ot: Output trajectory file (TUM format), in addition to the 'pose' stream of the KLG file.\n"
+                "Optional -depthcodec: Re-encode depth with 'zlib', 'rvl' or 'raw', instead of copying it.\n"
+                "Optional -register: Warp colour into the depth camera, using the calibration of the sens file. By default, colour is only resized.\n"
+                "klg -> sens:\n"
+                "Optional -w, -h: Image size (default: 640x480, or as stored in v2 files).\n"
+                "Optional -sensor: Sensor name (default: klg).\n"
+                "\n"
+                "Example: ./convert_scnnet_sens_klg -i scene0000_00.sens -o scene0000_00.klg -ot scene0000_00.txt" << endl;
+        return 1;
+    }
+
+    const string input = parser.getOption("-i");
+    const string output = parser.getOption("-o");
+    auto extension = [](const string& path){ return path.substr(path.find_last_of(".") + 1); };
+    const size_t numThreads = std::max(1, parser.getIntOption("-threads", defaultThreadCount()));
+
+    if(extension(input) == "sens" && extension(output) == "klg") sensToKlg(parser, input, output, numThreads);
+    else if(extension(input) == "klg" && extension(output) == "sens") klgToSens(parser, input, output, numThreads);
+    else throw std::invalid_argument("Expected a *.sens and a *.klg file.");
+
+    cout << endl;
+    return 0;
+}
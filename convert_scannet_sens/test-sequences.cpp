@@ -15,34 +15,55 @@ You should have received a copy of the GNU General Public License
 along with this program.  If not, see <http://www.gnu.org/licenses/>
 *****************************************************************/
 
+#include <array>
+#include <fstream>
 #include <iostream>
 #include <sstream>
-#include "../external/scannet/sensorData.h"
+#include <thread>
+#include "../common/common_sens.h"
+#include "../common/common_threading.h"
 
 using namespace std;
 
-string mat4f_to_string(const ml::mat4f& m){
+typedef std::array<float,16> Matrix4;
+
+struct SensAnalysis {
+    bool timestamp_issue = false;
+    bool pose_issue = false;
+    size_t num_frames = 0;
+    size_t num_complete_frames = 0;
+    Matrix4 calibration_depth;
+    Matrix4 calibration_color;
+    string error; // Set, if the file could not be read at all
+};
+
+string mat4f_to_string(const float* m){
     stringstream str;
     str << "["
-            << m.matrix[0] << ", " << m.matrix[1] << ", " << m.matrix[2] << ", " <<m.matrix[3] << "]["
-            << m.matrix[4] << ", " << m.matrix[5] << ", " << m.matrix[6] << ", " <<m.matrix[7] << "]["
-            << m.matrix[8] << ", " << m.matrix[9] << ", " << m.matrix[10] << ", " <<m.matrix[11] << "]["
-            << m.matrix[12] << ", " << m.matrix[13] << ", " << m.matrix[14] << ", " <<m.matrix[15] << "]]";
+            << m[0] << ", " << m[1] << ", " << m[2] << ", " <<m[3] << "]["
+            << m[4] << ", " << m[5] << ", " << m[6] << ", " <<m[7] << "]["
+            << m[8] << ", " << m[9] << ", " << m[10] << ", " <<m[11] << "]["
+            << m[12] << ", " << m[13] << ", " << m[14] << ", " <<m[15] << "]]";
     return str.str();
 }
 
-tuple<bool,bool,ml::mat4f,ml::mat4f> analyze_sens(const string& input, bool verbose = false){
+Matrix4 toMatrix4(const float* m){
+    Matrix4 result;
+    std::copy(m, m + 16, result.begin());
+    return result;
+}
 
-    // Input
-    if(verbose){
-        cout << "Loading data ... ";
-        cout.flush();
-    }
-    ml::SensorData sd(input);
-    if(verbose){
-        cout << "done!" << endl;
-        cout << sd << endl;
-    }
+SensAnalysis analyze_sens(const string& input, bool verbose = false){
+
+    // Input, only frame headers are read
+    SensReader sens(input);
+    if(verbose) cout << sens << endl;
+
+    SensAnalysis result;
+    result.num_frames = sens.numFrames();
+    result.num_complete_frames = sens.scanHeaders();
+    result.calibration_depth = toMatrix4(sens.calibrationDepth.intrinsic);
+    result.calibration_color = toMatrix4(sens.calibrationColor.intrinsic);
 
     // Stats
     bool ts_d_monotonic = true;
@@ -54,12 +75,12 @@ tuple<bool,bool,ml::mat4f,ml::mat4f> analyze_sens(const string& input, bool verb
 
     bool has_illegal_transformation = false;
 
-    for (size_t i = 0; i < sd.m_frames.size(); i++) {
+    for (size_t i = 0; i < result.num_complete_frames; i++) {
 
         // Test timestamps
-        const ml::SensorData::RGBDFrame& frame = sd.m_frames[i];
-        uint64_t t_d = frame.getTimeStampDepth();
-        uint64_t t_c = frame.getTimeStampColor();
+        const SensFrameInfo& frame = sens.frameInfo(i);
+        uint64_t t_d = frame.timeStampDepth;
+        uint64_t t_c = frame.timeStampColor;
         if (t_d > 0) ts_d_available = true;
         if (t_c > 0) ts_c_available = true;
         if (t_d < ts_d_last) ts_d_monotonic = false;
@@ -68,31 +89,37 @@ tuple<bool,bool,ml::mat4f,ml::mat4f> analyze_sens(const string& input, bool verb
         ts_c_last = t_c;
 
         // Test poses
-        ml::mat4f t = frame.getCameraToWorld();
-        if(t.matrix[15] != 1 || t.matrix[14] != 0 || t.matrix[13] != 0 || t.matrix[12] != 0){
+        const float* t = frame.cameraToWorld;
+        if(t[15] != 1 || t[14] != 0 || t[13] != 0 || t[12] != 0){
             has_illegal_transformation = true;
             if(verbose) cout << "Found illegal transformation at frame " << to_string(i) << ": " << mat4f_to_string(t) << endl;
         }
     }
 
     if(verbose){
+        const bool complete = result.num_complete_frames == result.num_frames;
         cout << "Depth timestamps are monotonic: " << (ts_d_monotonic ? "\x1B[32m yes" : "\x1B[31m no") << "\x1B[0m \n";
         cout << "RGB   timestamps are monotonic: " << (ts_c_monotonic ? "\x1B[32m yes" : "\x1B[31m no") << "\x1B[0m \n";
         cout << "Depth timestamps are available: " << (ts_d_available ? "\x1B[32m yes" : "\x1B[31m no") << "\x1B[0m \n";
         cout << "RGB   timestamps are available: " << (ts_c_available ? "\x1B[32m yes" : "\x1B[31m no") << "\x1B[0m \n";
         cout << "All  camera  poses  were legal: " << (!has_illegal_transformation ? "\x1B[32m yes" : "\x1B[31m no") << "\x1B[0m \n";
-        cout << endl;
+        cout << "All   sens   frames   complete:" << (complete ? "\x1B[32m yes" : "\x1B[31m no") << "\x1B[0m";
+        if(!complete) cout << " (" << result.num_complete_frames << " of " << result.num_frames << ")";
+        cout << "\n" << endl;
     }
-    return make_tuple(!ts_d_monotonic || !ts_c_monotonic, has_illegal_transformation, sd.m_calibrationDepth.m_intrinsic, sd.m_calibrationColor.m_intrinsic);
+    result.timestamp_issue = !ts_d_monotonic || !ts_c_monotonic;
+    result.pose_issue = has_illegal_transformation;
+    return result;
 }
 
 int main(int argc, char* argv[])
 {
-    if(argc < 2 || argc > 3) {
+    if(argc < 2 || argc > 4) {
         cout << "A tool to analyse scannet *.sens data.\n\n"
                 "Error, invalid arguments.\n"
                 "Mandatory: input *.sens file / input *.txt file\n"
-                "Optional path to dataset dir (if txt is provided)."
+                "Optional path to dataset dir (if txt is provided).\n"
+                "Optional number of threads (if txt is provided, default: number of cores)."
              << endl;
         return 1;
     }
@@ -100,38 +127,72 @@ int main(int argc, char* argv[])
     // Input data
     string filename = argv[1];
     if(filename.substr(filename.find_last_of(".") + 1) == "txt"){
-        // Analyse many sens files
+        // Analyse many sens files, in parallel. Only frame headers are read, hence this is bound by seeks, not bandwidth.
         string sequence_name;
-        vector<ml::mat4f> calibration_depth;
-        vector<ml::mat4f> calibration_color;
-        string root = (argc == 3 ? argv[2] : "");
+        vector<string> sequence_names;
+        vector<Matrix4> calibration_depth;
+        vector<Matrix4> calibration_color;
+        string root = (argc >= 3 ? argv[2] : "");
         ifstream in_stream(filename);
-        while (getline(in_stream, sequence_name)){
-            cout << "Checking " << sequence_name << "...";
-            cout.flush();
-            tuple<bool,bool,ml::mat4f,ml::mat4f> r = analyze_sens(root + "/" + sequence_name + "/" + sequence_name  + ".sens");
-
-            if(get<0>(r))
-                cout << "\x1B[31m Timestamp issue \x1B[0m";
-            else
-                cout << "\x1B[32m Timestamps good \x1B[0m";
-
-            if(get<1>(r))
-                cout << "\x1B[31m Pose issue \x1B[0m";
-            else
-                cout << "\x1B[32m Poses good \x1B[0m";
-
-            cout << endl;
-            cout << mat4f_to_string(get<2>(r)) << endl;
-            cout << mat4f_to_string(get<3>(r)) << endl;
-            calibration_depth.push_back(get<2>(r));
-            calibration_color.push_back(get<3>(r));
-        }
+        while (getline(in_stream, sequence_name)) if(!sequence_name.empty()) sequence_names.push_back(sequence_name);
         in_stream.close();
+
+        const size_t num_threads = std::max(1, argc == 4 ? atoi(argv[3]) : int(defaultThreadCount()));
+        std::atomic<size_t> next_sequence(0);
+        BoundedQueue<pair<size_t,SensAnalysis>> results(sequence_names.size() + 1);
+        vector<std::thread> threads;
+        for(size_t t = 0; t < num_threads; t++){
+            threads.emplace_back([&](){
+                for(size_t s = next_sequence++; s < sequence_names.size(); s = next_sequence++){
+                    const string& name = sequence_names[s];
+                    SensAnalysis r;
+                    try {
+                        r = analyze_sens(root + "/" + name + "/" + name + ".sens");
+                    } catch(const std::exception& e) {
+                        r.error = e.what();
+                    }
+                    results.push(make_pair(s, r));
+                }
+            });
+        }
+
+        // Report in the order of the list
+        ReorderBuffer<SensAnalysis> reorder;
+        pair<size_t,SensAnalysis> item;
+        while(reorder.numEmitted() < sequence_names.size() && results.pop(item)){
+            reorder.push(item.first, item.second, [&](const SensAnalysis& r){
+                cout << "Checking " << sequence_names[reorder.numEmitted()] << "...";
+                if(!r.error.empty()){
+                    cout << "\x1B[31m Error: " << r.error << " \x1B[0m" << endl;
+                    return;
+                }
+
+                if(r.timestamp_issue)
+                    cout << "\x1B[31m Timestamp issue \x1B[0m";
+                else
+                    cout << "\x1B[32m Timestamps good \x1B[0m";
+
+                if(r.pose_issue)
+                    cout << "\x1B[31m Pose issue \x1B[0m";
+                else
+                    cout << "\x1B[32m Poses good \x1B[0m";
+
+                if(r.num_complete_frames != r.num_frames)
+                    cout << "\x1B[31m Truncated after " << r.num_complete_frames << " of " << r.num_frames << " frames \x1B[0m";
+
+                cout << endl;
+                cout << mat4f_to_string(r.calibration_depth.data()) << endl;
+                cout << mat4f_to_string(r.calibration_color.data()) << endl;
+                calibration_depth.push_back(r.calibration_depth);
+                calibration_color.push_back(r.calibration_color);
+            });
+        }
+        for(std::thread& t : threads) t.join();
+
         ofstream out_cal_d("cal-depth.txt");
         ofstream out_cal_c("cal-color.txt");
-        for(auto& m : calibration_depth) out_cal_d << mat4f_to_string(m) << "\n";
-        for(auto& m : calibration_color) out_cal_c << mat4f_to_string(m) << "\n";
+        for(auto& m : calibration_depth) out_cal_d << mat4f_to_string(m.data()) << "\n";
+        for(auto& m : calibration_color) out_cal_c << mat4f_to_string(m.data()) << "\n";
         out_cal_d.close();
         out_cal_c.close();
     } else {
@@ -17,8 +17,10 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>
 
 #include <cstddef>
 #include <iostream>
+#include <memory>
 #include "../common/common.h"
-#include "../external/scannet/sensorData.h"
+#include "../common/common_playback.h"
+#include "../common/common_sens.h"
 
 using namespace std;
 using namespace cv;
@@ -27,51 +29,81 @@ typedef std::chrono::time_point<std::chrono::system_clock> Time;
 typedef std::chrono::duration<double> Duration;
 typedef std::chrono::system_clock Clock;
 
+struct SensFrame {
+    Mat rgb; // BGR
+    Mat depth;
+    Mat depthScaled;
+};
+
 int main(int argc, char* argv[])
 {
     Parser parser(argc, argv);
 
     if(!parser.hasOption("-i")){
-        cout << "A tool to extract scannet *.sens data.\n\n";
+        cout << "A tool to view scannet *.sens data.\n\n";
         cout << "Error, invalid arguments.\n"
                 "Mandatory -i: input *.sens file\n"
+                "Optional -speed: Playback speed (default: 1, negative values play backwards)\n"
+                "Optional -threads: Number of decoding threads (default: number of cores - 1)\n"
+                "\n"
+                "Keys: space: pause, a/d: step back/forward, A/D: jump 100 frames, +/-: faster/slower, r: reverse, q: quit\n"
                 "\n"
-                "Example: ./convert_scannet_sens -i <filename>.sens" << endl;
+                "Example: ./view_scnnet_sens -i <filename>.sens" << endl;
 
         return 1;
     }
 
     // Input data
     string filename = parser.getStringOption("-i");
-    cout << "Loading data ... ";
-    cout.flush();
-    ml::SensorData sd(filename);
-    cout << "done!" << endl;
-    cout << sd << endl;
-
-    for (size_t i = 0; i < sd.m_frames.size(); i++) {
-        Time t = Clock::now();
-
-        //de-compress color and depth values
-        ml::vec3uc* colorData = sd.decompressColorAlloc(i);
-        unsigned short* depthData = sd.decompressDepthAlloc(i);
-
-        Mat depth(sd.m_depthHeight, sd.m_depthWidth, CV_16UC1, depthData);
-        Mat rgb(sd.m_colorHeight, sd.m_colorWidth, CV_8UC3, (unsigned char*)colorData);
-        cvtColor(rgb, rgb, cv::COLOR_BGR2RGB);
-
-        depth.convertTo(depth, CV_16UC1, 20);
-        cv::imshow("Depth", depth);
-        cv::waitKey(1);
-        cv::imshow("RGB", rgb);
-        cv::waitKey(1);
-
-        free(colorData);
-        free(depthData);
-
-        Duration d = Clock::now() - t;
-        cout << "Playback speed: " <<  1.0f / d.count() << "Hz\r";
-        cout.flush();
+    SensReader sens(filename);
+    cout << sens << endl;
+    if(sens.numFrames() == 0) return 0;
+
+    // Frames are decoded ahead by worker threads, into reused buffers
+    const size_t numThreads = std::max(1, parser.getIntOption("-threads", std::max(1u, defaultThreadCount() - 1)));
+    std::vector<std::unique_ptr<SensDecoder>> decoders;
+    for(size_t t = 0; t < numThreads; t++) decoders.emplace_back(new SensDecoder());
+    FramePlayer<SensFrame> player(sens.numFrames(), [&](size_t i, SensFrame& frame, size_t worker){
+        sens.prefetch(i);
+        sens.readColor(i, frame.rgb, *decoders[worker]);
+        sens.readDepth(i, frame.depth, *decoders[worker]);
+        frame.depth.convertTo(frame.depthScaled, CV_16UC1, 20);
+    }, 32, numThreads);
+
+    // ScanNet timestamps are often not set, in that case the clock falls back to 30Hz
+    std::vector<int64_t> timestamps(sens.numFrames());
+    for(size_t i = 0; i < sens.numFrames(); i++) timestamps[i] = sens.frameInfo(i).timeStampColor;
+    PlaybackClock clock(timestamps);
+    clock.setSpeed(parser.getDoubleOption("-speed", 1));
+    clock.play();
+
+    size_t shownFrame = std::numeric_limits<size_t>::max();
+    Time lastShown = Clock::now();
+    while(true){
+        const size_t currentFrame = clock.frame();
+        if(currentFrame != shownFrame){
+            const SensFrame& frame = player.get(currentFrame, clock.stride());
+            cv::imshow("Depth", frame.depthScaled);
+            cv::imshow("RGB", frame.rgb);
+            shownFrame = currentFrame;
+
+            Duration d = Clock::now() - lastShown;
+            lastShown = Clock::now();
+            cout << "Frame " << currentFrame << ", playback speed: " << 1.0f / d.count() << "Hz      \r";
+            cout.flush();
+        }
+
+        const int key = cv::waitKey(1);
+        if(key == 'q') break;
+        else if(key == ' ') clock.toggle();
+        else if(key == 'a') clock.step(-1);
+        else if(key == 'd') clock.step(1);
+        else if(key == 'A') clock.seek(currentFrame >= 100 ? currentFrame - 100 : 0);
+        else if(key == 'D') clock.seek(currentFrame + 100);
+        else if(key == '+') clock.setSpeed(clock.getSpeed() * 2);
+        else if(key == '-') clock.setSpeed(clock.getSpeed() / 2);
+        else if(key == 'r') clock.setSpeed(-clock.getSpeed());
+        else if(clock.isPlaying() && clock.atEnd()) break;
     }
 
     cout << endl;
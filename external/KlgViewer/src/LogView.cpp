@@ -1,6 +1,9 @@
-#include "Resolution.h"
-#include "RawLogReader.h"
-#include <fstream>
+#include "../../../common/common_klg.h"
+#include "../../../common/common_playback.h"
+#include "../../../common/JPEGLoader.h"
+#include <opencv2/opencv.hpp>
+#include <iomanip>
+#include <memory>
 
 int find_argument(int argc, char** argv, const char* argument_name)
 {
@@ -24,6 +27,16 @@ int parse_argument (int argc, char** argv, const char* str, int &val)
     return (index - 1);
 }
 
+int parse_argument (int argc, char** argv, const char* str, double &val)
+{
+    int index = find_argument (argc, argv, str) + 1;
+
+    if (index > 0 && index < argc )
+      val = atof (argv[index]);
+
+    return (index - 1);
+}
+
 int parse_argument (int argc, char** argv, const char* str, std::string &val)
 {
     int index = find_argument (argc, argv, str) + 1;
@@ -34,71 +47,140 @@ int parse_argument (int argc, char** argv, const char* str, std::string &val)
     return index - 1;
 }
 
+struct LogFrame
+{
+    cv::Mat rgb;
+    cv::Mat depthBuffer;
+    cv::Mat depthNormalized;
+    cv::Mat depthImg;
+};
+
+void printUsage()
+{
+    std::cout << "Usage: LogView -l <file.klg> [options]\n"
+                 "  -w, -h: Image size (default: 640x480, or as stored in v2 files)\n"
+                 "  -p: Show frames every p milliseconds, instead of at their recorded timestamps\n"
+                 "  -speed: Playback speed (default: 1, negative values play backwards)\n"
+                 "  -s, -f: Swap colour channels\n"
+                 "  -t: Number of decoding threads (default: number of cores - 1)\n"
+                 "Keys: space: pause, a/d: step back/forward, A/D: jump 100 frames, +/-: faster/slower, r: reverse, q: quit\n"
+                 "      The 'Frame' slider seeks." << std::endl;
+}
+
 int main(int argc, char * argv[])
 {
     int width = 640;
     int height = 480;
-    int pauseMS = 33;
+    int pauseMS = 0;
+    int numThreads = 0;
+    double speed = 1;
     bool switchColor = false;
 
+    std::string logFile;
+    if(parse_argument(argc, argv, "-l", logFile) < 0)
+    {
+        printUsage();
+        return 1;
+    }
+
+    KlgReader logReader(logFile);
+    if(logReader.hasFooter())
+    {
+        width = logReader.getMetadata().width;
+        height = logReader.getMetadata().height;
+    }
     parse_argument(argc, argv, "-w", width);
     parse_argument(argc, argv, "-h", height);
     parse_argument(argc, argv, "-p", pauseMS);
-    switchColor = find_argument(argc, argv, "-s") > -1;
-
-
-    Resolution::getInstance(width, height);
-
-    Bytef * decompressionBuffer = new Bytef[Resolution::getInstance().numPixels() * 2];
-    IplImage * deCompImage = 0;
+    parse_argument(argc, argv, "-speed", speed);
+    parse_argument(argc, argv, "-t", numThreads);
+    // -f used to flip colours when reading, -s when showing. Both swap channels, so they cancel out.
+    switchColor = (find_argument(argc, argv, "-s") > -1) != (find_argument(argc, argv, "-f") > -1);
 
-    std::string logFile;
-    assert(parse_argument(argc, argv, "-l", logFile) > 0 && "Please provide a log file");
-
-    RawLogReader logReader(decompressionBuffer,
-                           deCompImage,
-                           logFile,
-                           find_argument(argc, argv, "-f") != -1);
-
-    cv::Mat1b tmp(height, width);
-    cv::Mat3b depthImg(height, width);
-
-    unsigned currentFrame = 1;
-    while(logReader.hasMore())
+    const size_t numFrames = logReader.numFrames();
+    if(numFrames == 0)
     {
-        usleep(pauseMS * 1000);
-        std::cout << "Showing frame: " << currentFrame++ << "(ts: " << logReader.timestamp << ")" << std::endl;
-        logReader.getNext();
-
-        cv::Mat3b rgbImg(height, width, (cv::Vec<unsigned char, 3> *)logReader.deCompImage->imageData);
-        if(switchColor) cvtColor(rgbImg, rgbImg, CV_BGR2RGB);
-
-        cv::Mat1w depth(height, width, (unsigned short *)&decompressionBuffer[0]);
-
-        cv::normalize(depth, tmp, 0, 255, cv::NORM_MINMAX, 0);
-
-        cv::cvtColor(tmp, depthImg, CV_GRAY2RGB);
-
-        cv::imshow("RGB", rgbImg);
-
-        cv::imshow("Depth", depthImg);
-
-        char key = cv::waitKey(1);
-
-        if(key == 'q')
-            break;
-        else if(key == ' ')
-            key = cv::waitKey(0);
-            if(key == 'q')
-                break;
+        std::cout << "The log file does not contain any frames." << std::endl;
+        return 1;
     }
 
-    delete [] decompressionBuffer;
+    // Frames are decoded ahead by worker threads, into reused buffers
+    std::vector<std::unique_ptr<JPEGLoader>> jpegLoaders;
+    const size_t numWorkers = numThreads > 0 ? numThreads : std::max(1u, defaultThreadCount() - 1);
+    for(size_t t = 0; t < numWorkers; t++) jpegLoaders.emplace_back(new JPEGLoader());
 
-    if(deCompImage)
+    FramePlayer<LogFrame> player(numFrames, [&](size_t i, LogFrame& frame, size_t worker)
+    {
+        const KlgFrameInfo& info = logReader.frameInfo(i);
+        logReader.prefetch(i);
+
+        // Decoding with channel swap yields the same memory layout (BGR) as the raw path, '-s' then swaps both alike
+        frame.rgb.create(height, width, CV_8UC3);
+        if(logReader.isImageRaw(i, width, height))
+            memcpy(frame.rgb.data, logReader.imageData(i), info.imageSize);
+        else if(info.imageSize > 0)
+            jpegLoaders[worker]->decode(logReader.imageData(i), info.imageSize, frame.rgb.data, width, height, true);
+        else
+            frame.rgb.setTo(0);
+        if(switchColor) cv::cvtColor(frame.rgb, frame.rgb, cv::COLOR_RGB2BGR);
+
+        if(info.depthSize > 0)
+        {
+            cv::Mat depth = logReader.readDepth(i, width, height, frame.depthBuffer);
+            cv::normalize(depth, frame.depthNormalized, 0, 255, cv::NORM_MINMAX, CV_8UC1);
+        }
+        else
+        {
+            frame.depthNormalized.create(height, width, CV_8UC1);
+            frame.depthNormalized.setTo(0);
+        }
+        cv::cvtColor(frame.depthNormalized, frame.depthImg, cv::COLOR_GRAY2RGB);
+    }, 32, numWorkers);
+
+    std::vector<int64_t> timestamps(numFrames);
+    for(size_t i = 0; i < numFrames; i++) timestamps[i] = pauseMS > 0 ? int64_t(i) * pauseMS * 1000 : logReader.timestamp(i);
+    PlaybackClock clock(timestamps);
+    clock.setSpeed(speed);
+    clock.play();
+
+    cv::namedWindow("RGB");
+    cv::namedWindow("Depth");
+    int sliderPosition = 0;
+    cv::createTrackbar("Frame", "RGB", &sliderPosition, numFrames - 1);
+
+    size_t shownFrame = std::numeric_limits<size_t>::max();
+    while(true)
     {
-        cvReleaseImage(&deCompImage);
+        // The slider was moved by the user
+        if(shownFrame < numFrames && size_t(sliderPosition) != shownFrame) clock.seek(sliderPosition);
+
+        const size_t currentFrame = clock.frame();
+        if(currentFrame != shownFrame)
+        {
+            const LogFrame& frame = player.get(currentFrame, clock.stride());
+            std::cout << "Showing frame: " << std::setw(6) << currentFrame + 1 << " / " << numFrames
+                      << " (ts: " << logReader.timestamp(currentFrame) << ", speed: " << clock.getSpeed()
+                      << (clock.isPlaying() ? "" : ", paused") << ")      \r" << std::flush;
+            cv::imshow("RGB", frame.rgb);
+            cv::imshow("Depth", frame.depthImg);
+            shownFrame = currentFrame;
+            sliderPosition = currentFrame;
+            cv::setTrackbarPos("Frame", "RGB", sliderPosition);
+        }
+
+        const int key = cv::waitKey(5);
+        if(key == 'q') break;
+        else if(key == ' ') clock.toggle();
+        else if(key == 'a') clock.step(-1);
+        else if(key == 'd') clock.step(1);
+        else if(key == 'A') clock.seek(currentFrame >= 100 ? currentFrame - 100 : 0);
+        else if(key == 'D') clock.seek(currentFrame + 100);
+        else if(key == '+') clock.setSpeed(clock.getSpeed() * 2);
+        else if(key == '-') clock.setSpeed(clock.getSpeed() / 2);
+        else if(key == 'r') clock.setSpeed(-clock.getSpeed());
+        else if(clock.isPlaying() && clock.atEnd()) clock.pause();
     }
 
+    std::cout << std::endl;
     return 0;
 }
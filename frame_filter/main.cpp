@@ -0,0 +1,201 @@
+/******************************************************************
+This file is part of https://github.com/martinruenz/dataset-tools
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>
+*****************************************************************/
+
+/**
+ * Find static and near-duplicate frames of a KLG file or of an image sequence, and write the list of frames that are
+ * worth keeping. The list is understood by convert_klg (-keep) and convert_imagesToKlg (--keep).
+ *
+ * Signatures are computed in parallel, the selection itself is sequential, see ../common/common_signature.h.
+ */
+
+#include "../common/common.h"
+#include "../common/common_klg.h"
+#include "../common/common_signature.h"
+#include "../common/common_threading.h"
+#include "../common/JPEGLoader.h"
+#include <array>
+#include <fstream>
+#include <iomanip>
+#include <memory>
+#include <sstream>
+
+using namespace std;
+using namespace cv;
+
+int main(int argc, char * argv[])
+{
+    Parser parser(argc, argv);
+
+    const bool fromImages = parser.hasOption("-rgbdir") && parser.hasOption("-depthdir");
+    if((!parser.hasOption("-i") && !fromImages) || (!parser.hasOption("-o") && !parser.hasOption("-report"))){
+        cout << "Error, invalid arguments.\n"
+                "Mandatory -i: Input klg file, or:\n"
+                "Mandatory -rgbdir, -depthdir: Directories containing rgb and depth images (as used by convert_imagesToKlg).\n"
+                "Mandatory -o: Output file, listing the indices of kept frames (one per line). This or -report is required.\n"
+                "Optional -report: Output file, listing the changes of all frames compared to the last kept frame.\n"
+                "Optional -grey: Keep a frame, if the mean absolute grey value difference exceeds this value (default value: 2).\n"
+                "Optional -depth: Keep a frame, if the mean absolute depth difference [m] exceeds this value (default value: 0.01).\n"
+                "Optional -poses: File with one TUM pose (ts tx ty tz qx qy qz qw) per frame. Poses of v2 files ('pose' stream) are used by default.\n"
+                "Optional -translation: Keep a frame, if the camera moved further than this [m] (default value: 0.01).\n"
+                "Optional -rotation: Keep a frame, if the camera rotated more than this [deg] (default value: 1).\n"
+                "Optional -maxskip: Never skip more than this number of consecutive frames (default value: 0, unlimited).\n"
+                "Optional -s: Factor, which scales depth values of images to [m] (default value: 1).\n"
+                "Optional -w: Image width of klg files (default value: 640, or as stored in v2 files).\n"
+                "Optional -h: Image height of klg files (default value: 480, or as stored in v2 files).\n"
+                "Optional -threads: Number of worker threads (default value: number of cores).\n"
+                "\n"
+                "Example: ./frame_filter -i test.klg -o keep.txt -maxskip 30" << endl;
+        return 1;
+    }
+
+    FrameChangeThresholds thresholds;
+    thresholds.grey = parser.getDoubleOption("-grey", thresholds.grey);
+    thresholds.depth = parser.getDoubleOption("-depth", thresholds.depth);
+    thresholds.translation = parser.getDoubleOption("-translation", thresholds.translation);
+    thresholds.rotation = parser.getDoubleOption("-rotation", thresholds.rotation);
+    thresholds.maxSkip = parser.getIntOption("-maxskip", 0);
+
+    // Input
+    std::unique_ptr<KlgReader> klg;
+    string dirRGB, dirDepth;
+    vector<string> inputRGBs, inputDepths;
+    int width = parser.getIntOption("-w", 640);
+    int height = parser.getIntOption("-h", 480);
+    float metresPerDepthUnit = 0.001;
+    const float depthScale = parser.getFloatOption("-s", 1);
+    size_t numFrames;
+    if(fromImages){
+        dirRGB = parser.getDirOption("-rgbdir");
+        dirDepth = parser.getDirOption("-depthdir");
+        inputRGBs = getFilenames(dirRGB, { ".jpg", ".png"});
+        inputDepths = getFilenames(dirDepth, { ".exr", ".png"});
+        if(inputRGBs.size() != inputDepths.size()) throw std::invalid_argument("Number of rgb and depth images is not matching.");
+        numFrames = inputRGBs.size();
+    } else {
+        klg.reset(new KlgReader(parser.getOption("-i")));
+        if(klg->hasFooter()){
+            const KlgMetadata& metadata = klg->getMetadata();
+            if(!parser.hasOption("-w")) width = metadata.width;
+            if(!parser.hasOption("-h")) height = metadata.height;
+            metresPerDepthUnit = metadata.depthScale;
+        }
+        numFrames = klg->numFrames();
+    }
+
+    vector<Pose> poses;
+    if(parser.hasOption("-poses")){
+        for(const string& line : readFileLines(parser.getOption("-poses"), true)){
+            if(line[0] == '#') continue;
+            double ts, tx, ty, tz, qx, qy, qz, qw;
+            std::istringstream iss(line);
+            if(!(iss >> ts >> tx >> ty >> tz >> qx >> qy >> qz >> qw)) throw invalid_argument("Could not parse pose: " + line);
+            poses.emplace_back(Eigen::Vector3d(tx, ty, tz), Eigen::Quaterniond(qw, qx, qy, qz), ts);
+        }
+    } else if(klg && klg->findStream("pose") >= 0){
+        const int stream = klg->findStream("pose");
+        for(size_t i = 0; i < numFrames; i++){
+            std::array<double,7> p;
+            if(klg->streamSize(stream, i) != sizeof(p)) throw std::invalid_argument("Invalid pose of frame " + std::to_string(i) + ".");
+            memcpy(p.data(), klg->streamData(stream, i), sizeof(p));
+            poses.emplace_back(Eigen::Vector3d(p[0], p[1], p[2]), Eigen::Quaterniond(p[6], p[3], p[4], p[5]));
+        }
+    }
+    if(poses.size() && poses.size() != numFrames) throw invalid_argument("Number of poses != number of frames");
+
+    // Compute signatures
+    vector<FrameSignature> signatures(numFrames);
+    const size_t numThreads = std::max(1, parser.getIntOption("-threads", defaultThreadCount()));
+    BoundedQueue<size_t> tasks(2 * numThreads);
+    ThreadErrors errors;
+    std::atomic<size_t> numDone(0);
+    std::vector<std::thread> threads;
+
+    threads.emplace_back([&](){
+        for(size_t i = 0; i < numFrames && !errors.hasFailed(); i++){
+            if(klg) klg->prefetch(i);
+            if(!tasks.push(i)) break;
+        }
+        tasks.close();
+    });
+
+    for(size_t t = 0; t < numThreads; t++){
+        threads.emplace_back([&](){
+            JPEGLoader jpeg;
+            Mat depthBuffer, rgbBuffer, depthMetric;
+            if(!errors.capture([&](){
+                size_t i;
+                while(tasks.pop(i)){
+                    Mat rgb, depth;
+                    if(klg){
+                        const KlgFrameInfo& info = klg->frameInfo(i);
+                        if(info.depthSize) depth = klg->readDepth(i, width, height, depthBuffer);
+                        rgb = klg->imageView(i, width, height);
+                        if(rgb.empty() && info.imageSize){
+                            // Signatures only need thumbnails, hence the JPEG is decoded at 1/8 resolution
+                            int w, h;
+                            jpeg.readSize(klg->imageData(i), info.imageSize, w, h, 8);
+                            rgbBuffer.create(h, w, CV_8UC3);
+                            jpeg.decode(klg->imageData(i), info.imageSize, rgbBuffer.data, w, h, false, 0, 8);
+                            rgb = rgbBuffer;
+                        }
+                        if(!depth.empty()) depth.convertTo(depthMetric, CV_32FC1, metresPerDepthUnit);
+                    } else {
+                        rgb = imread(dirRGB + inputRGBs[i], cv::IMREAD_REDUCED_COLOR_4);
+                        depth = imread(dirDepth + inputDepths[i], cv::IMREAD_UNCHANGED);
+                        if(rgb.total() == 0) throw std::invalid_argument("Could not read rgb-image file: " + dirRGB + inputRGBs[i]);
+                        if(depth.total() == 0) throw std::invalid_argument("Could not read depth-image file: " + dirDepth + inputDepths[i]);
+                        depth.convertTo(depthMetric, CV_32FC1, depthScale);
+                    }
+                    signatures[i] = computeFrameSignature(rgb, depth.empty() ? Mat() : depthMetric);
+                    numDone++;
+                }
+            })) tasks.close();
+        });
+    }
+
+    Progress progress(numFrames);
+    for(size_t shown = 0; shown < numFrames && !errors.hasFailed();){
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        for(const size_t done = numDone; shown < done; shown++) progress.show();
+    }
+    for(std::thread& t : threads) t.join();
+    errors.rethrow();
+
+    // Select frames
+    FrameSelector selector(thresholds);
+    vector<size_t> kept;
+    ofstream report;
+    if(parser.hasOption("-report")){
+        report.open(parser.getOption("-report"));
+        if(!report.is_open()) throw invalid_argument("Could not open output file: " + parser.getOption("-report"));
+        report << "# frame kept grey depth hash_distance translation rotation\n";
+    }
+    for(size_t i = 0; i < numFrames; i++){
+        FrameChange change;
+        if(selector.add(signatures[i], poses.size() ? &poses[i] : nullptr, &change)) kept.push_back(i);
+        if(report.is_open())
+            report << i << " " << (kept.size() && kept.back() == i) << " " << change.grey << " " << change.depth << " "
+                   << change.hashDistance << " " << change.translation << " " << change.rotation << "\n";
+    }
+
+    if(parser.hasOption("-o")) writeFrameList(parser.getOption("-o"), kept);
+    cout << "\nKept " << kept.size() << " of " << numFrames << " frames";
+    if(numFrames) cout << " (" << std::fixed << std::setprecision(1) << 100.0 * kept.size() / numFrames << "%)";
+    cout << "." << endl;
+
+    return 0;
+}
@@ -0,0 +1,177 @@
+/******************************************************************
+This file is part of https://github.com/martinruenz/dataset-tools
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>
+*****************************************************************/
+
+/**
+ * Edit KLG files without decoding or re-encoding any frame.
+ *
+ * Frames are stored back-to-back, hence a range of frames is a single byte range of the file. Trimming, splitting and
+ * concatenating is done by copying such ranges and writing a new frame count. Retiming patches the timestamps of the
+ * frame headers in place. See ../common/common_klg.h for a description of the KLG format.
+ */
+
+#include "../common/common.h"
+#include "../common/common_klg.h"
+#include <cstddef>
+#include <cstdio>
+#include <iomanip>
+#include <memory>
+#include <sstream>
+
+using namespace std;
+
+struct FrameRange {
+    const KlgReader* klg;
+    size_t first;
+    size_t last;
+};
+
+/**
+ * @brief Write a new KLG file, consisting of the given frame ranges.
+ */
+void writeFrameRanges(const string& path, const std::vector<FrameRange>& ranges){
+    int outFd = open(path.c_str(), O_WRONLY | O_CREAT | O_EXCL, 0644);
+    if(outFd < 0) throw std::invalid_argument("Could not create output file (does it already exist?): " + path);
+
+    int32_t frameCount = 0;
+    uint64_t outOffset = KLG_FILE_HEADER_SIZE;
+    for(const FrameRange& r : ranges){
+        if(r.first > r.last) continue;
+        const uint64_t begin = r.klg->frameInfo(r.first).offset;
+        const uint64_t end = r.klg->frameInfo(r.last).endOffset();
+        copyFileRange(r.klg->getFileDescriptor(), begin, outFd, outOffset, end - begin);
+        outOffset += end - begin;
+        frameCount += r.last - r.first + 1;
+    }
+
+    bool success = pwrite(outFd, &frameCount, sizeof(int32_t), 0) == sizeof(int32_t);
+    success &= close(outFd) == 0;
+    if(!success) throw std::runtime_error("Could not write output file: " + path);
+    cout << "Wrote " << frameCount << " frames to: " << path << endl;
+}
+
+int main(int argc, char * argv[])
+{
+    Parser parser(argc, argv);
+
+    const int numModes = parser.hasOption("-trim") + parser.hasOption("-split") + parser.hasOption("-concat") + parser.hasOption("-retime");
+    if(!parser.hasOption("-i") || numModes != 1 || (!parser.hasOption("-o") && !parser.hasOption("-retime"))){
+        cout << "Error, invalid arguments.\n"
+                "Mandatory -i: Input klg file(s). Multiple files are only supported by -concat.\n"
+                "Mandatory -o: Output klg file (for -split: path prefix of output files). Not used by -retime.\n"
+                "\n"
+                "Modes (exactly one is required):\n"
+                "-trim: Keep frames -start to -end.\n"
+                "   Optional -start: First frame that is kept (default value: 0).\n"
+                "   Optional -end: Last frame that is kept (default value: last frame of file).\n"
+                "-split <n>: Split the input into files of n frames each (<o>_0000.klg, <o>_0001.klg, ...).\n"
+                "-concat: Concatenate all input files, in the given order.\n"
+                "-retime: Overwrite the timestamps of the input file, in place.\n"
+                "   Optional -fps: Set timestamps to -startstamp + i / fps (microseconds).\n"
+                "   Optional -startstamp: First timestamp, if -fps is used (default value: 0).\n"
+                "   Optional -timestamps: File that provides a timestamp for each frame (one per line).\n"
+                "   Optional -tss: Timestamp scaling factor, if -timestamps is used (default value: 1).\n"
+                "   Optional -offset: Add this value to all timestamps.\n"
+                "\n"
+                "Optional -noindex: Neither read nor write frame index files (<input>.idx).\n"
+                "\n"
+                "Note: Files written by -trim, -split and -concat are version 1 files, metadata and extra streams of v2 inputs are dropped.\n"
+                "\n"
+                "Example: ./klg_edit -i test.klg -o part.klg -trim -start 100 -end 199" << endl;
+        return 1;
+    }
+
+    const bool useIndex = !parser.hasOption("-noindex");
+    const string output = parser.getOption("-o");
+    std::vector<string> inputs = splitString(parser.getOption("-i"), ' ', false);
+    if(inputs.size() > 1 && !parser.hasOption("-concat"))
+        throw std::invalid_argument("Multiple input files are only supported by -concat.");
+
+    std::vector<std::unique_ptr<KlgReader>> klgs;
+    for(const string& input : inputs){
+        klgs.emplace_back(new KlgReader(input, useIndex));
+        if(klgs.back()->isTruncated())
+            cout << "Warning, " << input << " is truncated. Only " << klgs.back()->numFrames() << " of "
+                 << klgs.back()->getHeaderFrameCount() << " frames are used." << endl;
+    }
+    const KlgReader& klg = *klgs.front();
+    const int numFrames = klg.numFrames();
+
+    if(parser.hasOption("-trim")){
+        int startFrame = parser.getIntOption("-start", 0);
+        int endFrame = std::min(parser.getIntOption("-end", numFrames-1), numFrames-1);
+        if(startFrame < 0 || startFrame > endFrame) throw std::invalid_argument("Invalid frame range.");
+        writeFrameRanges(output, { { &klg, size_t(startFrame), size_t(endFrame) } });
+
+    } else if(parser.hasOption("-split")){
+        int chunkSize = parser.getIntOption("-split");
+        if(chunkSize < 1) throw std::invalid_argument("Invalid number of frames per file.");
+        string prefix = output;
+        if(prefix.size() > 4 && prefix.substr(prefix.size() - 4) == ".klg") prefix.resize(prefix.size() - 4);
+        for(int first = 0, part = 0; first < numFrames; first += chunkSize, part++){
+            std::stringstream path;
+            path << prefix << "_" << std::setfill('0') << std::setw(4) << part << ".klg";
+            writeFrameRanges(path.str(), { { &klg, size_t(first), size_t(std::min(first + chunkSize, numFrames) - 1) } });
+        }
+
+    } else if(parser.hasOption("-concat")){
+        std::vector<FrameRange> ranges;
+        for(const auto& k : klgs)
+            if(k->numFrames()) ranges.push_back({ k.get(), 0, k->numFrames() - 1 });
+        writeFrameRanges(output, ranges);
+
+    } else if(parser.hasOption("-retime")){
+        std::vector<int64_t> timestamps(numFrames);
+        if(parser.hasOption("-timestamps")){
+            vector<string> lines = readFileLines(parser.getOption("-timestamps"), true);
+            if(lines.size() != timestamps.size()) throw invalid_argument("Number of input timestamps != number of frames");
+            double tss = parser.getDoubleOption("-tss", 1);
+            for(int i = 0; i < numFrames; i++) timestamps[i] = std::stod(lines[i]) * tss;
+        } else if(parser.hasOption("-fps")) {
+            double fps = parser.getDoubleOption("-fps");
+            if(fps <= 0) throw std::invalid_argument("Invalid fps.");
+            int64_t startstamp = std::stoll(parser.getStringOption("-startstamp", "0"));
+            for(int i = 0; i < numFrames; i++) timestamps[i] = startstamp + int64_t(double(i) * 1e6 / fps);
+        } else {
+            for(int i = 0; i < numFrames; i++) timestamps[i] = klg.timestamp(i);
+        }
+        int64_t offset = std::stoll(parser.getStringOption("-offset", "0"));
+        for(int64_t& t : timestamps) t += offset;
+
+        int fd = open(inputs.front().c_str(), O_WRONLY);
+        if(fd < 0) throw std::invalid_argument("Could not open input file for writing: " + inputs.front());
+        for(int i = 0; i < numFrames; i++)
+            if(pwrite(fd, &timestamps[i], sizeof(int64_t), klg.frameInfo(i).offset) != sizeof(int64_t))
+                throw std::runtime_error("Could not write timestamp of frame " + std::to_string(i) + ".");
+
+        // The index of v2 files holds a copy of each frame header
+        KlgTrailer trailer;
+        if(klg.hasFooter() && readKlgTrailer(klg.getFileDescriptor(), klg.getFileSize(), trailer)){
+            for(int i = 0; i < numFrames; i++){
+                const uint64_t entryOffset = trailer.indexOffset + i * sizeof(KlgFooterEntry) + offsetof(KlgFooterEntry, info) + offsetof(KlgFrameInfo, timestamp);
+                if(pwrite(fd, &timestamps[i], sizeof(int64_t), entryOffset) != sizeof(int64_t))
+                    throw std::runtime_error("Could not write index entry of frame " + std::to_string(i) + ".");
+            }
+        }
+        close(fd);
+
+        // The index caches timestamps, it is rebuilt on the next use
+        std::remove(KlgReader::indexPath(inputs.front()).c_str());
+        cout << "Retimed " << numFrames << " frames." << endl;
+    }
+
+    return 0;
+}
@@ -0,0 +1,194 @@
+/******************************************************************
+This file is part of https://github.com/martinruenz/dataset-tools
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>
+*****************************************************************/
+
+/**
+ * Validate a KLG file by walking its frame headers only, payloads are never read or decoded.
+ * See ../common/common_klg.h for a description of the KLG format.
+ */
+
+#include "../common/common.h"
+#include "../common/common_klg.h"
+#include <cstdio>
+#include <iomanip>
+#include <limits>
+
+using namespace std;
+
+struct SizeStatistics {
+    int32_t min = std::numeric_limits<int32_t>::max();
+    int32_t max = 0;
+    uint64_t sum = 0;
+    size_t numEmpty = 0;
+
+    void add(int32_t size){
+        min = std::min(min, size);
+        max = std::max(max, size);
+        sum += size;
+        if(size == 0) numEmpty++;
+    }
+
+    void print(const string& name, size_t count) const {
+        cout << name << " sizes [bytes]: min " << (count ? min : 0) << ", max " << max
+             << ", mean " << (count ? sum / count : 0) << ", empty payloads: " << numEmpty << endl;
+    }
+};
+
+int main(int argc, char * argv[])
+{
+    Parser parser(argc, argv);
+
+    if(!parser.hasOption("-i")){
+        cout << "Error, invalid arguments.\n"
+                "Mandatory -i: Input klg file.\n"
+                "Optional -w: Image width, used to tell raw from compressed payloads (default value: 640).\n"
+                "Optional -h: Image height, used to tell raw from compressed payloads (default value: 480).\n"
+                "Optional -gap: Report timestamp deltas larger than this factor times the median delta (default value: 2).\n"
+                "Optional -maxlist: Maximum number of listed timestamp issues (default value: 10).\n"
+                "Optional -crc: Verify the CRCs of all frames of v2 files (reads all payloads).\n"
+                "Optional -fix: Rewrite the frame count in the file header to the number of complete frames.\n"
+                "\n"
+                "Returns 0 if the file is consistent, 2 if issues were found.\n"
+                "Example: ./klg_inspect -i test.klg -fix" << endl;
+        return 1;
+    }
+
+    string inputFile = parser.getOption("-i");
+    int width = parser.getIntOption("-w", 640);
+    int height = parser.getIntOption("-h", 480);
+    double gapFactor = parser.getDoubleOption("-gap", 2);
+    size_t maxList = parser.getIntOption("-maxlist", 10);
+    bool fix = parser.hasOption("-fix");
+
+    int fd = open(inputFile.c_str(), fix ? O_RDWR : O_RDONLY);
+    if(fd < 0){
+        cout << "Could not open input file: " << inputFile << endl;
+        return 1;
+    }
+
+    // Walk all headers up to the end of the file, to also find frames that are missing in the header count
+    KlgScan scan = scanKlgHeaders(fd, true);
+    const size_t numFrames = scan.frames.size();
+    const uint64_t endOfFrames = numFrames ? scan.frames.back().endOffset() : KLG_FILE_HEADER_SIZE;
+    bool issues = false;
+
+    cout << "File size: " << scan.fileSize << " bytes\n"
+         << "Version: " << (scan.hasFooter ? "2 (with footer)" : "1") << "\n"
+         << "Frame count in header: " << scan.headerFrameCount << "\n"
+         << "Complete frames: " << numFrames << endl;
+
+    if(scan.headerFrameCount != (int64_t)numFrames){
+        issues = true;
+        if(scan.headerFrameCount > (int64_t)numFrames)
+            cout << "Warning, the header announces " << scan.headerFrameCount - (int64_t)numFrames << " frames more than the file contains." << endl;
+        else
+            cout << "Warning, the file contains " << (int64_t)numFrames - scan.headerFrameCount << " frames more than the header announces." << endl;
+    }
+    if(scan.truncated){
+        issues = true;
+        cout << "Warning, the file is truncated. The incomplete frame " << numFrames << " starts at byte offset "
+             << scan.truncationOffset << ", " << scan.fileSize - scan.truncationOffset << " bytes are left over." << endl;
+    }
+
+    // Payload sizes
+    SizeStatistics depthSizes, imageSizes;
+    size_t numRawDepth = 0, numRawImage = 0;
+    for(const KlgFrameInfo& f : scan.frames){
+        depthSizes.add(f.depthSize);
+        imageSizes.add(f.imageSize);
+        if(f.depthSize == width * height * 2) numRawDepth++;
+        if(f.imageSize == width * height * 3) numRawImage++;
+    }
+    depthSizes.print("Depth", numFrames);
+    imageSizes.print("Image", numFrames);
+    cout << "Raw payloads (at " << width << "x" << height << "): depth " << numRawDepth << ", image " << numRawImage
+         << " of " << numFrames << " frames" << endl;
+
+    // Timestamps
+    if(numFrames > 1){
+        std::vector<int64_t> deltas(numFrames - 1);
+        for(size_t i = 1; i < numFrames; i++) deltas[i-1] = scan.frames[i].timestamp - scan.frames[i-1].timestamp;
+
+        std::vector<int64_t> sorted = deltas;
+        std::nth_element(sorted.begin(), sorted.begin() + sorted.size() / 2, sorted.end());
+        const int64_t median = sorted[sorted.size() / 2];
+
+        size_t numBackwards = 0, numDuplicates = 0, numGaps = 0, numListed = 0;
+        for(size_t i = 0; i < deltas.size(); i++){
+            const char* issue = nullptr;
+            if(deltas[i] < 0){
+                numBackwards++;
+                issue = "decreasing";
+            } else if(deltas[i] == 0){
+                numDuplicates++;
+                issue = "duplicate";
+            } else if(median > 0 && deltas[i] > gapFactor * median){
+                numGaps++;
+                issue = "gap";
+            }
+            if(issue && numListed++ < maxList)
+                cout << "  frame " << std::setw(7) << i+1 << ": " << issue << " timestamp " << scan.frames[i+1].timestamp
+                     << " (delta " << deltas[i] << ")" << endl;
+        }
+        if(numListed > maxList) cout << "  ... " << numListed - maxList << " more" << endl;
+
+        cout << "Timestamps: first " << scan.frames.front().timestamp << ", last " << scan.frames.back().timestamp
+             << ", median delta " << median << "\n"
+             << "Timestamp issues: " << numBackwards << " decreasing, " << numDuplicates << " duplicates, "
+             << numGaps << " gaps (> " << gapFactor << "x median delta)" << endl;
+        if(numBackwards || numDuplicates) issues = true;
+    }
+
+    if(scan.hasFooter){
+        KlgReader klg(inputFile, false);
+        const KlgMetadata& m = klg.getMetadata();
+        cout << "Metadata: " << m.width << "x" << m.height << ", fx " << m.fx << ", fy " << m.fy << ", cx " << m.cx
+             << ", cy " << m.cy << ", depth scale " << m.depthScale << " m\n"
+             << "Extra streams:";
+        for(size_t s = 0; s < klg.numStreams(); s++) cout << " " << klg.streamName(s);
+        cout << (klg.numStreams() ? "" : " none") << endl;
+        if(!klg.hasFooter()){
+            issues = true;
+            cout << "Warning, the footer does not match the frames of the file." << endl;
+        } else if(parser.hasOption("-crc")){
+            size_t numCorrupt = 0;
+            for(size_t i = 0; i < klg.numFrames(); i++){
+                if(klg.verifyFrame(i)) continue;
+                if(numCorrupt++ < maxList) cout << "  frame " << std::setw(7) << i << ": CRC mismatch" << endl;
+            }
+            cout << "Corrupt frames: " << numCorrupt << endl;
+            if(numCorrupt) issues = true;
+        }
+    }
+
+    if(fix){
+        if(scan.headerFrameCount == (int64_t)numFrames){
+            cout << "Header frame count is correct, nothing to fix." << endl;
+        } else {
+            int32_t frameCount = numFrames;
+            if(pwrite(fd, &frameCount, sizeof(int32_t), 0) != sizeof(int32_t)) throw std::runtime_error("Could not write header.");
+            // An existing index still describes the old header
+            std::remove(KlgReader::indexPath(inputFile).c_str());
+            cout << "Fixed frame count in header: " << scan.headerFrameCount << " -> " << frameCount << ". ";
+            if(endOfFrames < scan.fileSize)
+                cout << "Trailing " << scan.fileSize - endOfFrames << " bytes (starting at " << endOfFrames << ") are ignored by readers.";
+            cout << endl;
+        }
+    }
+
+    close(fd);
+    return issues ? 2 : 0;
+}
@@ -0,0 +1,284 @@
+/******************************************************************
+This file is part of https://github.com/martinruenz/dataset-tools
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>
+*****************************************************************/
+
+/**
+ * Stream frames from one KLG file to another and transform them in memory (depth noise, depth scaling, cropping and
+ * resizing), instead of extracting, converting and re-packing image files.
+ *
+ * Payloads that are not affected by any transformation are copied without decoding them. Colour is never converted
+ * between channel orders: it is decoded and re-encoded with the same memory layout. See ../common/common_klg.h for a
+ * description of the KLG format.
+ */
+
+#include "../common/common.h"
+#include "../common/common_depth.h"
+#include "../common/common_klg.h"
+#include "../common/common_threading.h"
+#include "../common/JPEGLoader.h"
+
+using namespace std;
+using namespace cv;
+
+struct TransformedFrame {
+    size_t index;
+    std::vector<unsigned char> depth;
+    std::vector<unsigned char> rgb;
+    std::vector<std::vector<unsigned char>> streams; // Only filled, if a stream had to be transformed
+};
+
+std::vector<int> parseInts(const string& values, size_t count, const string& option){
+    std::vector<int> result;
+    for(const string& v : splitString(values, ' ', false)) result.push_back(std::stoi(v));
+    if(result.size() != count) throw std::invalid_argument("Option " + option + " requires " + std::to_string(count) + " values.");
+    return result;
+}
+
+int main(int argc, char * argv[])
+{
+    Parser parser(argc, argv);
+
+    if(!parser.hasOption("-i") || !parser.hasOption("-o")){
+        cout << "Error, invalid arguments.\n"
+                "Mandatory -i: Input klg file.\n"
+                "Mandatory -o: Output klg file.\n"
+                "Optional -n: Add noise to depth data. See 'A Benchmark for RGB-D Visual Odometry, 3D Reconstruction and SLAM'\n"
+                "Optional   -ns: Include normal shifts in noise (Not perfect!).\n"
+                "Optional   -dv: Discretisation value. Default: 35130.0f\n"
+                "Optional -depthfactor: Multiply depth values with this factor.\n"
+                "Optional -crop <x y w h>: Crop frames to this rectangle (applied before -resize).\n"
+                "Optional -resize <w h>: Resize frames (depth and masks: nearest neighbour, colour: area).\n"
+                "Optional -depthcodec: Depth codec of transformed depth: zlib, rvl or raw (default: codec of the input).\n"
+                "Optional -quality: JPEG quality of transformed colour (default: 90).\n"
+                "Optional -w: Image width (default value: 640, or as stored in v2 files).\n"
+                "Optional -h: Image height (default value: 480, or as stored in v2 files).\n"
+                "Optional -cx, -cy, -fx, -fy: Intrinsics (default values: 320, 240, 528, 528, or as stored in v2 files).\n"
+                "Optional -threads: Number of worker threads (default value: number of cores).\n"
+                "\n"
+                "v2 files stay v2 files, with updated metadata. ID masks (stream 'mask') are cropped and resized as well.\n"
+                "Example: ./klg_transform -i clean.klg -o noisy.klg -n" << endl;
+        return 1;
+    }
+
+    string outputFile = parser.getOption("-o");
+    if(exists(outputFile)){
+        cerr << "Out file already exists." << endl;
+        return 2;
+    }
+
+    KlgReader klg(parser.getOption("-i"));
+    if(klg.isTruncated())
+        cout << "Warning, KLG file is truncated. Only " << klg.numFrames() << " of " << klg.getHeaderFrameCount() << " frames are transformed." << endl;
+
+    // Input geometry, v2 files describe themselves, options given on the command line take precedence
+    KlgMetadata metadata;
+    if(klg.hasFooter()) metadata = klg.getMetadata();
+    else {
+        metadata.width = 640;
+        metadata.height = 480;
+        metadata.cx = 320;
+        metadata.cy = 240;
+        metadata.fx = metadata.fy = 528;
+    }
+    if(parser.hasOption("-w")) metadata.width = parser.getIntOption("-w");
+    if(parser.hasOption("-h")) metadata.height = parser.getIntOption("-h");
+    if(parser.hasOption("-cx")) metadata.cx = parser.getFloatOption("-cx");
+    if(parser.hasOption("-cy")) metadata.cy = parser.getFloatOption("-cy");
+    if(parser.hasOption("-fx")) metadata.fx = parser.getFloatOption("-fx");
+    if(parser.hasOption("-fy")) metadata.fy = parser.getFloatOption("-fy");
+    const int width = metadata.width;
+    const int height = metadata.height;
+
+    PinholeParameters intrinsics;
+    intrinsics.cx = metadata.cx;
+    intrinsics.cy = metadata.cy;
+    intrinsics.fx = metadata.fx;
+    intrinsics.fy = metadata.fy;
+
+    // Transformations
+    const bool doNoise = parser.hasOption("-n");
+    const bool doNormalShift = parser.hasOption("-ns");
+    const float discretisation = parser.getFloatOption("-dv", 35130.0f);
+    const bool doScale = parser.hasOption("-depthfactor");
+    const float depthFactor = parser.getFloatOption("-depthfactor", 1);
+    const bool doCrop = parser.hasOption("-crop");
+    const bool doResize = parser.hasOption("-resize");
+    Rect crop(0, 0, width, height);
+    if(doCrop){
+        std::vector<int> r = parseInts(parser.getOption("-crop"), 4, "-crop");
+        crop = Rect(r[0], r[1], r[2], r[3]);
+        if((crop & Rect(0, 0, width, height)) != crop || crop.area() == 0) throw std::invalid_argument("Invalid crop rectangle.");
+    }
+    Size outSize = crop.size();
+    if(doResize){
+        std::vector<int> s = parseInts(parser.getOption("-resize"), 2, "-resize");
+        outSize = Size(s[0], s[1]);
+        if(outSize.area() == 0) throw std::invalid_argument("Invalid size.");
+    }
+    const bool geometric = doCrop || doResize;
+    const bool depthTouched = geometric || doNoise || doScale || parser.hasOption("-depthcodec");
+    const bool forcedCodec = parser.hasOption("-depthcodec");
+    const KlgDepthCodec outCodec = parseKlgDepthCodec(parser.getStringOption("-depthcodec", "zlib"));
+    const int jpegQuality = parser.getIntOption("-quality", 90);
+    const float metresPerDepthUnit = metadata.depthScale;
+    const int maskStream = klg.findStream("mask");
+
+    // Output metadata
+    KlgMetadata outMetadata = metadata;
+    outMetadata.width = outSize.width;
+    outMetadata.height = outSize.height;
+    const double sx = double(outSize.width) / crop.width;
+    const double sy = double(outSize.height) / crop.height;
+    outMetadata.cx = (metadata.cx - crop.x + 0.5) * sx - 0.5;
+    outMetadata.cy = (metadata.cy - crop.y + 0.5) * sy - 0.5;
+    outMetadata.fx = metadata.fx * sx;
+    outMetadata.fy = metadata.fy * sy;
+
+    auto transformImage = [&](const Mat& in, int interpolation) -> Mat {
+        Mat result = in(crop);
+        if(doResize) cv::resize(result, result, outSize, 0, 0, interpolation);
+        return result;
+    };
+
+    // Open the output before any thread is started, a failure can then simply throw
+    KlgWriter writer(outputFile);
+    if(klg.hasFooter()){
+        std::vector<string> streamNames;
+        for(size_t s = 0; s < klg.numStreams(); s++) streamNames.push_back(klg.streamName(s));
+        writer.enableFooter(outMetadata, streamNames);
+    }
+
+    const size_t numFrames = klg.numFrames();
+    const size_t numThreads = std::max(1, parser.getIntOption("-threads", defaultThreadCount()));
+    BoundedQueue<size_t> tasks(2 * numThreads);
+    BoundedQueue<TransformedFrame> transformed(2 * numThreads);
+    ReorderWindow window(4 * numThreads); // Frames ahead of the writer
+    ThreadErrors errors;
+    std::atomic<size_t> activeWorkers(numThreads);
+    std::vector<std::thread> threads;
+    // Each worker draws noise from its own generator, seeded with 'noiseSeed + worker index'
+    const unsigned noiseSeed = std::chrono::system_clock::now().time_since_epoch().count();
+
+    auto closeQueues = [&](){
+        tasks.close();
+        transformed.close();
+        window.close();
+    };
+
+    threads.emplace_back([&](){
+        for(size_t i = 0; i < numFrames && !errors.hasFailed(); i++){
+            if(!window.acquire()) break;
+            klg.prefetch(i);
+            if(!tasks.push(i)) break;
+        }
+        tasks.close();
+    });
+
+    for(size_t t = 0; t < numThreads; t++){
+        threads.emplace_back([&, t](){
+            JPEGLoader jpeg;
+            Mat depthBuffer, scaledBuffer, rgbBuffer;
+            std::default_random_engine rng(noiseSeed + t);
+            if(!errors.capture([&](){
+                size_t i;
+                while(tasks.pop(i)){
+                    const KlgFrameInfo& info = klg.frameInfo(i);
+                    TransformedFrame frame;
+                    frame.index = i;
+
+                    // Depth
+                    const KlgDepthCodec inCodec = klg.depthCodec(i, width, height);
+                    if(!depthTouched || info.depthSize == 0 || (!geometric && !doNoise && !doScale && inCodec == outCodec)){
+                        frame.depth.assign(klg.depthData(i), klg.depthData(i) + info.depthSize);
+                    } else {
+                        Mat depth = klg.readDepth(i, width, height, depthBuffer);
+                        if(doNoise || doScale){
+                            Mat depthMetric;
+                            depth.convertTo(depthMetric, CV_32FC1, metresPerDepthUnit * depthFactor);
+                            if(doNoise) depthMetric = addNoise(depthMetric, intrinsics, doNormalShift, rng, 1.0, discretisation);
+                            // 'depth' may be a read-only view into the mapped file, never convert into it
+                            depthMetric.convertTo(scaledBuffer, CV_16UC1, 1.0 / metresPerDepthUnit);
+                            depth = scaledBuffer;
+                        }
+                        if(geometric) depth = transformImage(depth, INTER_NEAREST);
+                        if(!depth.isContinuous()) depth = depth.clone();
+                        compressKlgDepth(depth, frame.depth, forcedCodec ? outCodec : inCodec);
+                    }
+
+                    // Colour
+                    if(!geometric || info.imageSize == 0){
+                        frame.rgb.assign(klg.imageData(i), klg.imageData(i) + info.imageSize);
+                    } else {
+                        Mat rgb = klg.imageView(i, width, height);
+                        const bool raw = !rgb.empty();
+                        if(!raw){
+                            rgbBuffer.create(height, width, CV_8UC3);
+                            jpeg.decode(klg.imageData(i), info.imageSize, rgbBuffer.data, width, height, false);
+                            rgb = rgbBuffer;
+                        }
+                        rgb = transformImage(rgb, INTER_AREA);
+                        if(raw){
+                            if(!rgb.isContinuous()) rgb = rgb.clone();
+                            frame.rgb.assign(rgb.data, rgb.data + rgb.total() * rgb.elemSize());
+                        } else {
+                            cv::imencode(".jpg", rgb, frame.rgb, { cv::IMWRITE_JPEG_QUALITY, jpegQuality });
+                        }
+                    }
+
+                    // Extra streams, only masks depend on the image geometry
+                    if(geometric && maskStream >= 0 && klg.streamSize(maskStream, i) > 0){
+                        Mat encoded(1, klg.streamSize(maskStream, i), CV_8UC1, (void*)klg.streamData(maskStream, i));
+                        Mat mask = cv::imdecode(encoded, cv::IMREAD_UNCHANGED);
+                        if(mask.empty()) throw std::invalid_argument("Could not decode mask of frame " + std::to_string(i) + ".");
+                        frame.streams.resize(klg.numStreams());
+                        cv::imencode(".png", transformImage(mask, INTER_NEAREST), frame.streams[maskStream]);
+                    }
+
+                    if(!transformed.push(std::move(frame))) break;
+                }
+            })) closeQueues();
+            if(--activeWorkers == 0) transformed.close();
+        });
+    }
+
+    Progress progress(numFrames);
+    ReorderBuffer<TransformedFrame> reorder;
+    if(!errors.capture([&](){
+        TransformedFrame frame;
+        while(transformed.pop(frame)){
+            size_t index = frame.index;
+            reorder.push(index, std::move(frame), [&](const TransformedFrame& f){
+                std::vector<KlgStreamData> streams(klg.numStreams());
+                for(size_t s = 0; s < streams.size(); s++){
+                    if((int)s == maskStream && f.streams.size())
+                        streams[s] = { f.streams[s].data(), uint32_t(f.streams[s].size()) };
+                    else
+                        streams[s] = { klg.streamData(s, f.index), klg.streamSize(s, f.index) };
+                }
+                writer.writeFrame(klg.timestamp(f.index), f.depth.data(), f.depth.size(), f.rgb.data(), f.rgb.size(), streams);
+                progress.show();
+                window.release();
+            });
+        }
+    })) closeQueues();
+
+    for(std::thread& t : threads) t.join();
+    errors.rethrow();
+    writer.close();
+    cout << "\nTransformed " << writer.numFrames() << " frames." << endl;
+
+    return 0;
+}